@@ -0,0 +1,48 @@
+#!/bin/sh
+# bench.sh
+#
+# What `make bench` runs.  Writes a synthetic corpus with bench_corpus (sized
+# by BENCH_CORPUS, e.g. BENCH_CORPUS="-files 64 -depth 200", into BENCH_DIR),
+# then dumps all of it once per attribute set, with BENCH_JOBS workers, and
+# prints for each set the parse time, cursors per second, output bytes per
+# second and peak memory, as reported by --profile and --mem-stats.
+
+set -e
+
+dir=${BENCH_DIR:-bench_data}
+jobs=${BENCH_JOBS:-0}
+
+./bench_corpus "$dir" $BENCH_CORPUS
+
+# the first value of a JSON field in a file
+field() {
+  sed -n "s/.*\"$1\":\([-0-9.e+]*\).*/\1/p" "$2" | head -n 1
+}
+
+run() {
+  name=$1
+  shift
+  ./cxcursor_info -p "$dir" -r -j "$jobs" -O "$dir/out" \
+    -T "$dir/profile.json" -R "$dir/memory.json" "$@" > /dev/null \
+    2> "$dir/log" || { cat "$dir/log"; exit 1; }
+  wall=$(field wall_seconds "$dir/profile.json")
+  parse=$(field parse "$dir/profile.json")
+  cursors=$(field cursors_per_second "$dir/profile.json")
+  tail -n 1 "$dir/memory.json" > "$dir/memory_total.json"
+  peak=$(field peak_rss "$dir/memory_total.json")
+  bytes=$(wc -c < "$dir/out")
+  awk -v name="$name" -v wall="$wall" -v parse="$parse" -v cursors="$cursors" \
+      -v bytes="$bytes" -v peak="$peak" 'BEGIN {
+    printf "%-10s %9.2f %9.2f %12.0f %12.2f %10.1f\n", name, wall, parse,
+           cursors, bytes / wall / 1048576, peak / 1048576
+  }'
+}
+
+printf "%-10s %9s %9s %12s %12s %10s\n" set wall_s parse_s cursors/s \
+  output_MB/s peak_MB
+run names --CursorSpelling --CursorKindSpelling
+run types --TypeSpelling --TypeKindSpelling --SizeOf --AlignOf
+run xrefs --CustomId --Referenced --Definition --CanonicalCursor
+run usrs --CursorUSR --location
+run ndjson -F ndjson --CursorSpelling --CursorUSR --location
+run all
@@ -0,0 +1,169 @@
+// bench_corpus.cc
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/* Writes a synthetic project for `make bench` to run cxcursor_info over, sized
+ * by the command line, along with its compile_commands.json:
+ *
+ *   bench_corpus directory [-files N] [-functions N] [-members N]
+ *                [-depth N] [-headers N]
+ *
+ * Every translation unit includes the same heavy header (a set of standard
+ * library headers, -headers of them, and the declarations shared by all the
+ * translation units), and instantiates a template -depth levels deep, to give
+ * the deep template instantiations that real code is full of.  Each one then
+ * defines a wide class, with -members data members and as many member
+ * functions, and -functions free functions, each calling the one before it so
+ * there are references to follow.  The same arguments always give the same
+ * files.
+ * */
+
+using namespace std;
+
+struct CorpusSize {
+  int files = 16;
+  int functions = 200;
+  int members = 100;
+  int depth = 64;
+  int headers = 8;
+};
+
+static const char *standard_headers[] = {
+    "vector", "string", "map", "memory", "functional", "algorithm",
+    "unordered_map", "set", "sstream", "tuple", "iostream", "list",
+    "deque", "array", "type_traits", "utility"};
+
+static void write_common_header(const string &directory,
+                                const CorpusSize &size) {
+  ofstream out(directory + "/common.h");
+  out << "#pragma once\n";
+  int header_count = sizeof(standard_headers) / sizeof(standard_headers[0]);
+  for (int i = 0; i < size.headers && i < header_count; ++i) {
+    out << "#include <" << standard_headers[i] << ">\n";
+  }
+  out << "\n"
+         "template <int N> struct Deep {\n"
+         "  using type = typename Deep<N - 1>::type;\n"
+         "  static constexpr int value = Deep<N - 1>::value + 1;\n"
+         "  template <typename T> static T twice(T t) {\n"
+         "    return Deep<N - 1>::twice(t) + Deep<N - 1>::twice(t);\n"
+         "  }\n"
+         "};\n"
+         "template <> struct Deep<0> {\n"
+         "  using type = int;\n"
+         "  static constexpr int value = 0;\n"
+         "  template <typename T> static T twice(T t) { return t; }\n"
+         "};\n"
+         "\n"
+         "template <typename... Ts> struct Nest;\n"
+         "template <> struct Nest<> { static int size() { return 0; } };\n"
+         "template <typename T, typename... Ts> struct Nest<T, Ts...> {\n"
+         "  T head;\n"
+         "  Nest<Ts...> tail;\n"
+         "  static int size() { return 1 + Nest<Ts...>::size(); }\n"
+         "};\n\n";
+  for (int i = 0; i < size.functions; ++i) {
+    out << "int shared_" << i << "(int x);\n";
+  }
+}
+
+static void write_translation_unit(const string &path, int unit,
+                                   const CorpusSize &size) {
+  ofstream out(path);
+  out << "#include \"common.h\"\n\n"
+      << "namespace unit_" << unit << " {\n\n"
+      << "class Wide {\n"
+      << "public:\n";
+  for (int i = 0; i < size.members; ++i) {
+    out << "  int get_" << i << "() const { return member_" << i << "; }\n";
+  }
+  out << "\nprivate:\n";
+  for (int i = 0; i < size.members; ++i) {
+    out << "  int member_" << i << " = " << i << ";\n";
+  }
+  out << "};\n\n"
+      << "int deep() {\n"
+      << "  return Deep<" << size.depth << ">::value + Deep<" << size.depth
+      << ">::twice(1) + Nest<int, long, char, short, float, double>::size();\n"
+      << "}\n\n"
+      << "int function_0(int x) { return x + deep(); }\n";
+  for (int i = 1; i < size.functions; ++i) {
+    out << "int function_" << i << "(int x) {\n"
+        << "  std::vector<int> values{x, " << i << "};\n"
+        << "  return function_" << i - 1 << "(values.back()) + shared_" << i
+        << "(x);\n"
+        << "}\n";
+  }
+  out << "\n} // namespace unit_" << unit << "\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0]
+         << " directory [-files N] [-functions N] [-members N] [-depth N]"
+            " [-headers N]"
+         << endl;
+    return 1;
+  }
+  CorpusSize size;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    string arg = argv[i];
+    int value = atoi(argv[i + 1]);
+    if (arg == "-files") {
+      size.files = value;
+    } else if (arg == "-functions") {
+      size.functions = value;
+    } else if (arg == "-members") {
+      size.members = value;
+    } else if (arg == "-depth") {
+      size.depth = value;
+    } else if (arg == "-headers") {
+      size.headers = value;
+    } else {
+      cerr << "unknown option " << arg << endl;
+      return 1;
+    }
+  }
+  if (size.functions < 1) {
+    size.functions = 1;
+  }
+  // the functions use std::vector
+  if (size.headers < 1) {
+    size.headers = 1;
+  }
+
+  mkdir(argv[1], 0755);
+  char resolved[PATH_MAX];
+  if (realpath(argv[1], resolved) == nullptr) {
+    cerr << "could not create " << argv[1] << endl;
+    return 1;
+  }
+  string directory = resolved;
+  write_common_header(directory, size);
+  ofstream database(directory + "/compile_commands.json");
+  database << "[\n";
+  for (int unit = 0; unit < size.files; ++unit) {
+    string name = "unit_" + to_string(unit) + ".cc";
+    write_translation_unit(directory + "/" + name, unit, size);
+    database << "  {\"directory\": \"" << directory
+             << "\", \"command\": \"clang++ -std=c++14 -ftemplate-depth=1024 "
+                "-c "
+             << name << "\", \"file\": \"" << name << "\"}"
+             << (unit + 1 < size.files ? ",\n" : "\n");
+  }
+  database << "]\n";
+  if (!database) {
+    cerr << "could not write " << directory << "/compile_commands.json"
+         << endl;
+    return 1;
+  }
+  cerr << "wrote " << size.files << " translation units to " << directory
+       << endl;
+  return 0;
+}
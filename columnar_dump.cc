@@ -0,0 +1,567 @@
+// columnar_dump.cc
+
+#include "columnar_dump.h"
+#include "cursor_id_table.h"
+#include "output_sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The binary dump (-F binary) stores one column per chosen attribute instead
+ * of one record per cursor, so a reader interested in, say, isVirtual only
+ * touches the pages holding that column.  The file is laid out so it can be
+ * used straight from mmap:
+ *
+ *   ColumnarHeader
+ *   ColumnEntry[column_count]       name, type, offset and size of a column
+ *   column data                     each column starts 8 byte aligned
+ *   uint64_t[string_count + 1]      offsets into the string data
+ *   string data                     every distinct string, once
+ *
+ * The first two columns are always "translation_unit" and "depth", followed
+ * by the chosen attributes in the usual (sorted) order.  Column types:
+ *
+ *   Bits       predicates, one bit per record, packed into uint64_t words
+ *   U8         CXXRefQualifier and StorageClass, the libclang enum value
+ *   U32        depth, and CustomId and the other cursor references (0 is null)
+ *   I64        SizeOf, AlignOf, NumArguments, NumTemplateArguments
+ *   StringRef  uint32_t index into the string table, null_string if null
+ *   Location   LocationCell, the file being a StringRef
+ *
+ * Everything is written in the byte order of the machine writing it.  Unlike
+ * the text formats, every value is stored, meaningless or not.  A file is
+ * checked when it is opened: every column and string has to lie within it,
+ * and every column has to hold a cell for each record.
+ * */
+
+using namespace std;
+
+static ColumnType column_type(AttributeValue::Kind kind) {
+  switch (kind) {
+  case AttributeValue::Bool:
+    return ColumnType::Bits;
+  case AttributeValue::RefQualifier:
+  case AttributeValue::StorageClass:
+    return ColumnType::U8;
+  case AttributeValue::Id:
+  case AttributeValue::Null:
+    return ColumnType::U32;
+  case AttributeValue::Integer:
+    return ColumnType::I64;
+  case AttributeValue::Text:
+    return ColumnType::StringRef;
+  case AttributeValue::Location:
+    return ColumnType::Location;
+  }
+  return ColumnType::U32;
+}
+
+ColumnarDump::ColumnarDump(const vector<CursorAttribute> &a)
+    : attributes(a), record_count(0), translation_unit(null_string),
+      id_base(0) {
+  columns.resize(attributes.size() + 2);
+  columns[0].name = "translation_unit";
+  columns[0].type = ColumnType::StringRef;
+  columns[1].name = "depth";
+  columns[1].type = ColumnType::U32;
+  for (size_t i = 0; i < attributes.size(); ++i) {
+    const AttributeEntry &entry = attribute_entry(attributes[i]);
+    columns[i + 2].name = entry.name;
+    columns[i + 2].type = column_type(entry.kind);
+  }
+}
+
+uint32_t ColumnarDump::intern(const char *str, size_t size) {
+  auto it = string_ids.find(string(str, size));
+  if (it != string_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = (uint32_t)strings.size();
+  strings.emplace_back(str, size);
+  string_ids.emplace(strings.back(), id);
+  return id;
+}
+
+/*
+ * CXFiles are only meaningful within their translation unit, hence the reset.
+ */
+void ColumnarDump::begin_translation_unit(const string &name) {
+  translation_unit = intern(name.c_str(), name.size());
+  file_ids.clear();
+}
+
+uint32_t ColumnarDump::file_id(CXFile file) {
+  if (file == nullptr) {
+    return null_string;
+  }
+  auto it = file_ids.find(file);
+  if (it != file_ids.end()) {
+    return it->second;
+  }
+  CXString cxname = clang_getFileName(file);
+  const char *name = clang_getCString(cxname);
+  uint32_t id = name == nullptr ? null_string : intern(name, strlen(name));
+  clang_disposeString(cxname);
+  file_ids.emplace(file, id);
+  return id;
+}
+
+static void push_bit(vector<uint64_t> &bits, uint64_t row, bool value) {
+  if (row % 64 == 0) {
+    bits.push_back(0);
+  }
+  if (value) {
+    bits.back() |= uint64_t(1) << (row % 64);
+  }
+}
+
+static string column_name(const ColumnEntry &entry) {
+  return string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+}
+
+static bool get_bit(const uint64_t *bits, uint64_t row) {
+  return (bits[row / 64] >> (row % 64)) & 1;
+}
+
+void ColumnarDump::push_value(Column &column, const AttributeValue &value) {
+  switch (column.type) {
+  case ColumnType::Bits:
+    push_bit(column.bits, record_count, value.number != 0);
+    break;
+  case ColumnType::U8:
+    column.bytes.push_back((uint8_t)value.number);
+    break;
+  case ColumnType::U32:
+    column.words.push_back(
+        value.kind == AttributeValue::Null ? 0 : (uint32_t)value.number);
+    break;
+  case ColumnType::I64:
+    column.integers.push_back(value.number);
+    break;
+  case ColumnType::StringRef: {
+    const char *text =
+        value.kind != AttributeValue::Text ? nullptr : value_text(value);
+    column.words.push_back(text == nullptr ? null_string
+                                           : intern(text, strlen(text)));
+  } break;
+  case ColumnType::Location:
+    column.locations.push_back(
+        LocationCell{file_id(value.file), value.line, value.col});
+    break;
+  }
+}
+
+void ColumnarDump::add_record(CXCursor cursor, unsigned depth) {
+  columns[0].words.push_back(translation_unit);
+  columns[1].words.push_back(depth);
+  CursorContext context(cursor);
+  for (size_t i = 0; i < attributes.size(); ++i) {
+    push_value(columns[i + 2],
+               attribute_value(attribute_entry(attributes[i]), context));
+  }
+  ++record_count;
+}
+
+/*
+ * Appends the records of another dump of the same attributes, moving its
+ * strings into this string table.
+ */
+void ColumnarDump::append(const ColumnarDump &other) {
+  vector<uint32_t> remap(other.strings.size());
+  for (size_t i = 0; i < other.strings.size(); ++i) {
+    remap[i] = intern(other.strings[i].data(), other.strings[i].size());
+  }
+  auto remap_string = [&](uint32_t id) {
+    return id == null_string ? null_string : remap[id];
+  };
+  for (size_t c = 0; c < columns.size(); ++c) {
+    Column &column = columns[c];
+    const Column &from = other.columns[c];
+    switch (column.type) {
+    case ColumnType::Bits:
+      for (uint64_t row = 0; row < other.record_count; ++row) {
+        push_bit(column.bits, record_count + row,
+                 get_bit(from.bits.data(), row));
+      }
+      break;
+    case ColumnType::U8:
+      column.bytes.insert(column.bytes.end(), from.bytes.begin(),
+                          from.bytes.end());
+      break;
+    case ColumnType::U32:
+      column.words.insert(column.words.end(), from.words.begin(),
+                          from.words.end());
+      break;
+    case ColumnType::I64:
+      column.integers.insert(column.integers.end(), from.integers.begin(),
+                             from.integers.end());
+      break;
+    case ColumnType::StringRef:
+      for (uint32_t id : from.words) {
+        column.words.push_back(remap_string(id));
+      }
+      break;
+    case ColumnType::Location:
+      for (const LocationCell &cell : from.locations) {
+        column.locations.push_back(
+            LocationCell{remap_string(cell.file), cell.line, cell.col});
+      }
+      break;
+    }
+  }
+  record_count += other.record_count;
+}
+
+/*
+ * The ids counted within each translation unit of a file (every U32 column
+ * but depth, below usr_id_bit) are shifted past the ones of the translation
+ * units before it, as the translation_unit column tells them apart.  Returns
+ * the first row and the shift of each translation unit.
+ */
+static vector<pair<uint64_t, uint32_t>> id_shifts(const ColumnarFile &file,
+                                                 uint32_t &id_base) {
+  vector<pair<uint64_t, uint32_t>> shifts;
+  vector<const uint32_t *> id_columns;
+  for (uint32_t c = 2; c < file.column_count(); ++c) {
+    if (file.column(c).type == ColumnType::U32) {
+      id_columns.push_back((const uint32_t *)file.data(file.column(c)));
+    }
+  }
+  const uint32_t *units = (const uint32_t *)file.data(file.column(0));
+  uint32_t largest = 0;
+  for (uint64_t row = 0; row < file.records(); ++row) {
+    if (row == 0 || units[row] != units[row - 1]) {
+      id_base += largest;
+      largest = 0;
+      shifts.emplace_back(row, id_base);
+    }
+    for (const uint32_t *ids : id_columns) {
+      if ((ids[row] & usr_id_bit) == 0) {
+        largest = max(largest, ids[row]);
+      }
+    }
+  }
+  id_base += largest;
+  return shifts;
+}
+
+static uint32_t shift_id(uint32_t id, uint32_t shift) {
+  return id == 0 || (id & usr_id_bit) != 0 ? id : id + shift;
+}
+
+/*
+ * The same for a dump read back from a file, which has to have been written
+ * with the same attributes.  With rebase_ids, the ids of every translation
+ * unit are shifted past those of all the translation units appended before
+ * (see id_shifts), so they are unique in the whole dump; USR ids (-U) are the
+ * same everywhere already and are kept as they are.
+ */
+bool ColumnarDump::append(const ColumnarFile &file, bool rebase_ids) {
+  if (file.column_count() != columns.size()) {
+    return false;
+  }
+  for (uint32_t c = 0; c < file.column_count(); ++c) {
+    if (columns[c].name != column_name(file.column(c)) ||
+        columns[c].type != file.column(c).type) {
+      return false;
+    }
+  }
+  vector<uint32_t> remap(file.string_count());
+  for (uint32_t i = 0; i < file.string_count(); ++i) {
+    string str = file.string(i);
+    remap[i] = intern(str.data(), str.size());
+  }
+  auto remap_string = [&](uint32_t id) {
+    return id == null_string || id >= remap.size() ? null_string : remap[id];
+  };
+  uint64_t rows = file.records();
+  vector<pair<uint64_t, uint32_t>> shifts;
+  if (rebase_ids && columns.size() > 2) {
+    shifts = id_shifts(file, id_base);
+  }
+  for (size_t c = 0; c < columns.size(); ++c) {
+    Column &column = columns[c];
+    const ColumnEntry &entry = file.column((uint32_t)c);
+    const void *data = file.data(entry);
+    switch (column.type) {
+    case ColumnType::Bits:
+      for (uint64_t row = 0; row < rows; ++row) {
+        push_bit(column.bits, record_count + row,
+                 get_bit((const uint64_t *)data, row));
+      }
+      break;
+    case ColumnType::U8: {
+      const uint8_t *bytes = (const uint8_t *)data;
+      column.bytes.insert(column.bytes.end(), bytes, bytes + rows);
+    } break;
+    case ColumnType::U32: {
+      const uint32_t *words = (const uint32_t *)data;
+      if (c == 1 || shifts.empty()) {
+        column.words.insert(column.words.end(), words, words + rows);
+        break;
+      }
+      size_t unit = 0;
+      for (uint64_t row = 0; row < rows; ++row) {
+        while (unit + 1 < shifts.size() && shifts[unit + 1].first <= row) {
+          ++unit;
+        }
+        column.words.push_back(shift_id(words[row], shifts[unit].second));
+      }
+    } break;
+    case ColumnType::I64: {
+      const int64_t *integers = (const int64_t *)data;
+      column.integers.insert(column.integers.end(), integers,
+                             integers + rows);
+    } break;
+    case ColumnType::StringRef: {
+      const uint32_t *words = (const uint32_t *)data;
+      for (uint64_t row = 0; row < rows; ++row) {
+        column.words.push_back(remap_string(words[row]));
+      }
+    } break;
+    case ColumnType::Location: {
+      const LocationCell *cells = (const LocationCell *)data;
+      for (uint64_t row = 0; row < rows; ++row) {
+        column.locations.push_back(LocationCell{
+            remap_string(cells[row].file), cells[row].line, cells[row].col});
+      }
+    } break;
+    }
+  }
+  record_count += rows;
+  return true;
+}
+
+static size_t align8(size_t offset) { return (offset + 7) & ~size_t(7); }
+
+static void append_bytes(string &result, const void *data, size_t size) {
+  result.append((const char *)data, size);
+}
+
+template <typename T>
+static void append_vector(string &result, const vector<T> &values) {
+  if (!values.empty()) {
+    append_bytes(result, values.data(), values.size() * sizeof(T));
+  }
+}
+
+void ColumnarDump::write(OutputSink &out) const {
+  vector<ColumnEntry> entries(columns.size());
+  size_t offset =
+      sizeof(ColumnarHeader) + entries.size() * sizeof(ColumnEntry);
+  for (size_t c = 0; c < columns.size(); ++c) {
+    const Column &column = columns[c];
+    ColumnEntry &entry = entries[c];
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, column.name.c_str(), sizeof(entry.name) - 1);
+    entry.type = column.type;
+    switch (column.type) {
+    case ColumnType::Bits:
+      entry.width = 0;
+      entry.size = column.bits.size() * sizeof(uint64_t);
+      break;
+    case ColumnType::U8:
+      entry.width = 1;
+      entry.size = column.bytes.size();
+      break;
+    case ColumnType::U32:
+    case ColumnType::StringRef:
+      entry.width = 4;
+      entry.size = column.words.size() * sizeof(uint32_t);
+      break;
+    case ColumnType::I64:
+      entry.width = 8;
+      entry.size = column.integers.size() * sizeof(int64_t);
+      break;
+    case ColumnType::Location:
+      entry.width = sizeof(LocationCell);
+      entry.size = column.locations.size() * sizeof(LocationCell);
+      break;
+    }
+    offset = align8(offset);
+    entry.offset = offset;
+    offset += entry.size;
+  }
+
+  vector<uint64_t> string_offsets(strings.size() + 1, 0);
+  for (size_t i = 0; i < strings.size(); ++i) {
+    string_offsets[i + 1] = string_offsets[i] + strings[i].size();
+  }
+
+  ColumnarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, columnar_magic, sizeof(header.magic));
+  header.record_count = record_count;
+  header.column_count = (uint32_t)columns.size();
+  header.string_count = (uint32_t)strings.size();
+  header.string_offsets_offset = align8(offset);
+  header.string_data_offset = header.string_offsets_offset +
+                              string_offsets.size() * sizeof(uint64_t);
+
+  string &result = out.buffer();
+  size_t written = out.bytes_written();
+  append_bytes(result, &header, sizeof(header));
+  append_vector(result, entries);
+  for (size_t c = 0; c < columns.size(); ++c) {
+    result.append(written + entries[c].offset - out.bytes_written(), '\0');
+    const Column &column = columns[c];
+    append_vector(result, column.bits);
+    append_vector(result, column.bytes);
+    append_vector(result, column.words);
+    append_vector(result, column.integers);
+    append_vector(result, column.locations);
+    out.record_done();
+  }
+  result.append(written + header.string_offsets_offset - out.bytes_written(),
+                '\0');
+  append_vector(result, string_offsets);
+  for (auto &&str : strings) {
+    result += str;
+    out.record_done();
+  }
+}
+
+ColumnarFile::ColumnarFile()
+    : base(nullptr), length(0), header(nullptr), entries(nullptr),
+      string_offsets(nullptr) {}
+
+ColumnarFile::~ColumnarFile() {
+  if (base != nullptr) {
+    munmap((void *)base, length);
+  }
+}
+
+/*
+ * The bytes a column of the given type takes for rows records, 0 for a type
+ * we don't know.
+ */
+static uint64_t column_size(ColumnType type, uint64_t rows) {
+  switch (type) {
+  case ColumnType::Bits:
+    return (rows + 63) / 64 * sizeof(uint64_t);
+  case ColumnType::U8:
+    return rows;
+  case ColumnType::U32:
+  case ColumnType::StringRef:
+    return rows * sizeof(uint32_t);
+  case ColumnType::I64:
+    return rows * sizeof(int64_t);
+  case ColumnType::Location:
+    return rows * sizeof(LocationCell);
+  }
+  return 0;
+}
+
+/*
+ * Everything the accessors read has to lie within the mapping, so a truncated
+ * or corrupt file is turned down here rather than read past its end.
+ */
+bool ColumnarFile::check() {
+  if (memcmp(header->magic, columnar_magic, sizeof(columnar_magic)) != 0) {
+    problem = "not a columnar dump";
+    return false;
+  }
+  if (header->column_count >
+      (length - sizeof(ColumnarHeader)) / sizeof(ColumnEntry)) {
+    problem = "truncated column table";
+    return false;
+  }
+  // every record takes at least a byte, in the depth column if nowhere else
+  uint64_t rows = header->record_count;
+  if (rows > length) {
+    problem = "more records than the file can hold";
+    return false;
+  }
+  for (uint32_t c = 0; c < header->column_count; ++c) {
+    const ColumnEntry &entry = entries[c];
+    uint64_t needed = column_size(entry.type, rows);
+    if (needed == 0 && rows != 0) {
+      problem = "column " + column_name(entry) + " has an unknown type";
+      return false;
+    }
+    if (entry.offset % 8 != 0 || entry.offset > length ||
+        entry.size > length - entry.offset || entry.size < needed) {
+      problem = "column " + column_name(entry) +
+                " lies outside the file or is too short";
+      return false;
+    }
+  }
+  uint64_t offsets_size =
+      ((uint64_t)header->string_count + 1) * sizeof(uint64_t);
+  if (header->string_offsets_offset % 8 != 0 ||
+      header->string_offsets_offset > length ||
+      offsets_size > length - header->string_offsets_offset ||
+      header->string_data_offset <
+          header->string_offsets_offset + offsets_size ||
+      header->string_data_offset > length) {
+    problem = "string table lies outside the file";
+    return false;
+  }
+  string_offsets = (const uint64_t *)(base + header->string_offsets_offset);
+  uint64_t data_size = length - header->string_data_offset;
+  for (uint32_t i = 0; i < header->string_count; ++i) {
+    if (string_offsets[i] > string_offsets[i + 1] ||
+        string_offsets[i + 1] > data_size) {
+      problem = "string " + to_string(i) + " lies outside the file";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ColumnarFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    problem = "could not open it";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ColumnarHeader)) {
+    problem = "too short for a columnar dump";
+    close(fd);
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    problem = "could not map it";
+    return false;
+  }
+  base = (const char *)mapping;
+  length = (size_t)info.st_size;
+  header = (const ColumnarHeader *)base;
+  entries = (const ColumnEntry *)(base + sizeof(ColumnarHeader));
+  if (!check()) {
+    munmap(mapping, length);
+    base = nullptr;
+    return false;
+  }
+  return true;
+}
+
+const ColumnEntry *ColumnarFile::find_column(const std::string &name) const {
+  for (uint32_t i = 0; i < header->column_count; ++i) {
+    if (name == column_name(entries[i])) {
+      return &entries[i];
+    }
+  }
+  return nullptr;
+}
+
+bool ColumnarFile::bit(const ColumnEntry &entry, uint64_t row) const {
+  return get_bit((const uint64_t *)data(entry), row);
+}
+
+std::string ColumnarFile::string(uint32_t index) const {
+  if (index >= header->string_count) {
+    return "";
+  }
+  return std::string(base + header->string_data_offset + string_offsets[index],
+                     string_offsets[index + 1] - string_offsets[index]);
+}
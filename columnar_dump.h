@@ -0,0 +1,123 @@
+//columnar_dump.h
+#pragma once
+
+#include "cxcursor_info.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class OutputSink;
+class ColumnarFile;
+
+/*
+ * See columnar_dump.cc for more detailed commentary
+ */
+
+enum class ColumnType : std::uint32_t {
+  Bits = 1,
+  U8 = 2,
+  U32 = 3,
+  I64 = 4,
+  StringRef = 5,
+  Location = 6
+};
+
+struct ColumnarHeader {
+  char magic[8];
+  std::uint64_t record_count;
+  std::uint32_t column_count;
+  std::uint32_t string_count;
+  std::uint64_t string_offsets_offset;
+  std::uint64_t string_data_offset;
+};
+
+struct ColumnEntry {
+  char name[48];
+  ColumnType type;
+  std::uint32_t width;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+struct LocationCell {
+  std::uint32_t file;
+  std::uint32_t line;
+  std::uint32_t col;
+};
+
+static const char columnar_magic[8] = {'C', 'X', 'C', 'O', 'L', 'S', '1', 0};
+static const std::uint32_t null_string = 0xffffffff;
+
+/*
+ * Collects cursor records column by column, then writes them out in one go.
+ */
+class ColumnarDump {
+public:
+  explicit ColumnarDump(const std::vector<CursorAttribute> &attributes);
+
+  void begin_translation_unit(const std::string &name);
+  void add_record(CXCursor cursor, unsigned depth);
+  void append(const ColumnarDump &other);
+  bool append(const ColumnarFile &file, bool rebase_ids = false);
+  std::uint64_t size() const { return record_count; }
+  std::uint32_t intern(const char *str, std::size_t size);
+  void write(OutputSink &out) const;
+
+private:
+  struct Column {
+    std::string name;
+    ColumnType type;
+    std::vector<std::uint64_t> bits;
+    std::vector<std::uint8_t> bytes;
+    std::vector<std::uint32_t> words;
+    std::vector<std::int64_t> integers;
+    std::vector<LocationCell> locations;
+  };
+  std::vector<CursorAttribute> attributes;
+  std::vector<Column> columns;
+  std::uint64_t record_count;
+  std::uint32_t translation_unit;
+  std::uint32_t id_base;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, std::uint32_t> string_ids;
+  std::unordered_map<CXFile, std::uint32_t> file_ids;
+
+  std::uint32_t file_id(CXFile file);
+  void push_value(Column &column, const AttributeValue &value);
+};
+
+/*
+ * A read only, memory mapped view of a columnar dump.
+ */
+class ColumnarFile {
+public:
+  ColumnarFile();
+  ~ColumnarFile();
+  ColumnarFile(const ColumnarFile &) = delete;
+  ColumnarFile &operator=(const ColumnarFile &) = delete;
+
+  bool open(const std::string &path);
+  std::uint64_t records() const { return header->record_count; }
+  std::uint32_t column_count() const { return header->column_count; }
+  const ColumnEntry &column(std::uint32_t i) const { return entries[i]; }
+  const ColumnEntry *find_column(const std::string &name) const;
+  const void *data(const ColumnEntry &entry) const {
+    return base + entry.offset;
+  }
+  bool bit(const ColumnEntry &entry, std::uint64_t row) const;
+  std::uint32_t string_count() const { return header->string_count; }
+  std::string string(std::uint32_t index) const;
+  const std::string &error() const { return problem; }
+
+private:
+  std::string problem;
+  const char *base;
+  std::size_t length;
+  const ColumnarHeader *header;
+  const ColumnEntry *entries;
+  const std::uint64_t *string_offsets;
+
+  bool check();
+};
@@ -0,0 +1,387 @@
+// cursor_filter.cc
+
+#include "cursor_filter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+/* --where takes a boolean expression over the attribute names of
+ * attribute_table, for example
+ *
+ *   isDeclaration && !isInSystemHeader && (isVirtual || isPureVirtual)
+ *   CursorKindSpelling == "CXXMethod" && StorageClass != "Static"
+ *
+ * A bare name is true when the attribute would be displayed without -v, so a
+ * predicate is true when it holds and an attribute when it is not empty.  ==
+ * and != compare the value as it is printed against a quoted string, a number
+ * or a bare word.  The expression is compiled once into a small stack program
+ * with jumps for && and ||, so a cursor only pays for the attributes it needs
+ * to decide.
+ *
+ * isInSystemHeader and isFromMainFile depend only on the file a cursor was
+ * expanded in, which is the same for everything below it, unless an #include
+ * sits inside the cursor: the declarations of hdr.h in
+ *
+ *   extern "C" {
+ *   #include "hdr.h"
+ *   }
+ *
+ * are children of a LinkageSpec in the main file.  So before a cursor is
+ * looked at the program is also run in three valued logic, where every other
+ * attribute is unknown.  If it comes out false, and no #include directive lies
+ * within the cursor's extent, nothing in the subtree can match and the walk
+ * skips it without visiting it, which is most of a translation unit for a
+ * filter like !isInSystemHeader.  A cursor whose extent doesn't start and end
+ * in the same file is never skipped.
+ * */
+
+using namespace std;
+
+namespace {
+
+enum Truth : unsigned char { False, True, Unknown };
+
+bool subtree_invariant(CursorAttribute attribute) {
+  return attribute == CursorAttribute::isInSystemHeader ||
+         attribute == CursorAttribute::isFromMainFile;
+}
+
+} // namespace
+
+/*
+ * A recursive descent parser that emits the program as it goes:
+ *
+ *   or         := and ('||' and)*
+ *   and        := unary ('&&' unary)*
+ *   unary      := '!' unary | '(' or ')' | comparison
+ *   comparison := name [('==' | '!=') literal]
+ */
+class FilterCompiler {
+public:
+  FilterCompiler(const string &e, CursorFilter &f)
+      : expression(e), position(0), filter(f), depth(0), max_depth(0) {}
+
+  bool compile(string &error) {
+    if (!parse_or()) {
+      error = message;
+      return false;
+    }
+    skip_space();
+    if (position != expression.size()) {
+      error = "unexpected '" + expression.substr(position) + "'";
+      return false;
+    }
+    if (max_depth > CursorFilter::max_stack) {
+      error = "expression nested too deeply";
+      return false;
+    }
+    return true;
+  }
+
+private:
+  const string &expression;
+  size_t position;
+  CursorFilter &filter;
+  size_t depth;
+  size_t max_depth;
+  string message;
+
+  void skip_space() {
+    while (position < expression.size() && isspace(expression[position])) {
+      ++position;
+    }
+  }
+
+  bool accept(const char *token) {
+    skip_space();
+    size_t size = strlen(token);
+    if (expression.compare(position, size, token) != 0) {
+      return false;
+    }
+    position += size;
+    return true;
+  }
+
+  bool fail(const string &what) {
+    if (message.empty()) {
+      message = what + " at offset " + to_string(position);
+    }
+    return false;
+  }
+
+  void emit(CursorFilter::Op op, CursorAttribute attribute = {},
+            uint32_t operand = 0) {
+    filter.program.push_back(CursorFilter::Instruction{op, attribute, operand});
+  }
+
+  void push() {
+    if (++depth > max_depth) {
+      max_depth = depth;
+    }
+  }
+
+  bool word(string &result) {
+    skip_space();
+    size_t start = position;
+    while (position < expression.size() &&
+           (isalnum(expression[position]) || expression[position] == '_' ||
+            expression[position] == '-')) {
+      ++position;
+    }
+    result = expression.substr(start, position - start);
+    return !result.empty();
+  }
+
+  bool literal(string &result) {
+    skip_space();
+    if (position >= expression.size() || expression[position] != '"') {
+      return word(result);
+    }
+    result.clear();
+    for (++position; position < expression.size(); ++position) {
+      char c = expression[position];
+      if (c == '"') {
+        ++position;
+        return true;
+      }
+      if (c == '\\' && position + 1 < expression.size()) {
+        c = expression[++position];
+      }
+      result += c;
+    }
+    return fail("unterminated string");
+  }
+
+  /*
+   * Both operands stay on the stack unless the first one already decides the
+   * result, in which case the jump leaves it there as the result.
+   */
+  bool parse_binary(const char *token, CursorFilter::Op jump,
+                    CursorFilter::Op combine,
+                    bool (FilterCompiler::*operand)()) {
+    if (!(this->*operand)()) {
+      return false;
+    }
+    while (accept(token)) {
+      size_t jump_at = filter.program.size();
+      emit(jump);
+      if (!(this->*operand)()) {
+        return false;
+      }
+      emit(combine);
+      --depth;
+      filter.program[jump_at].operand = (uint32_t)filter.program.size();
+    }
+    return true;
+  }
+
+  bool parse_or() {
+    return parse_binary("||", CursorFilter::Op::JumpIfTrue,
+                        CursorFilter::Op::Or, &FilterCompiler::parse_and);
+  }
+
+  bool parse_and() {
+    return parse_binary("&&", CursorFilter::Op::JumpIfFalse,
+                        CursorFilter::Op::And, &FilterCompiler::parse_unary);
+  }
+
+  bool parse_unary() {
+    skip_space();
+    if (expression.compare(position, 2, "!=") != 0 && accept("!")) {
+      if (!parse_unary()) {
+        return false;
+      }
+      emit(CursorFilter::Op::Not);
+      return true;
+    }
+    if (accept("(")) {
+      if (!parse_or()) {
+        return false;
+      }
+      if (!accept(")")) {
+        return fail("expected ')'");
+      }
+      return true;
+    }
+    return parse_comparison();
+  }
+
+  bool parse_comparison() {
+    string name;
+    if (!word(name)) {
+      return fail("expected an attribute name");
+    }
+    CursorAttribute attribute;
+    if (!find_attribute(name, attribute)) {
+      return fail("unknown attribute " + name);
+    }
+    if (subtree_invariant(attribute)) {
+      filter.prunable = true;
+    }
+    push();
+    CursorFilter::Op op;
+    if (accept("==")) {
+      op = CursorFilter::Op::Equal;
+    } else if (accept("!=")) {
+      op = CursorFilter::Op::NotEqual;
+    } else {
+      emit(CursorFilter::Op::Test, attribute);
+      return true;
+    }
+    string value;
+    if (!literal(value)) {
+      return fail("expected a value to compare " + name + " with");
+    }
+    emit(op, attribute, (uint32_t)filter.literals.size());
+    filter.literals.push_back(value);
+    return true;
+  }
+};
+
+bool CursorFilter::compile(const string &expression, string &error) {
+  program.clear();
+  literals.clear();
+  prunable = false;
+  FilterCompiler compiler(expression, *this);
+  if (!compiler.compile(error)) {
+    program.clear();
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Runs the program.  With subtree set, only the attributes that hold for the
+ * whole subtree are looked at and the rest are Unknown.
+ */
+unsigned char CursorFilter::run(CursorContext &context, bool subtree) const {
+  unsigned char stack[max_stack];
+  size_t top = 0;
+  string text;
+  for (size_t pc = 0; pc < program.size(); ++pc) {
+    const Instruction &instruction = program[pc];
+    switch (instruction.op) {
+    case Op::Test:
+    case Op::Equal:
+    case Op::NotEqual: {
+      if (subtree && !subtree_invariant(instruction.attribute)) {
+        stack[top++] = Unknown;
+        break;
+      }
+      const AttributeEntry &entry = attribute_entry(instruction.attribute);
+      AttributeValue value = attribute_value(entry, context);
+      bool result;
+      if (instruction.op == Op::Test) {
+        result = !meaningless_value(value);
+      } else {
+        text.clear();
+        append_value(text, value);
+        result = (text == literals[instruction.operand]) ==
+                 (instruction.op == Op::Equal);
+      }
+      stack[top++] = result ? True : False;
+      break;
+    }
+    case Op::Not:
+      if (stack[top - 1] != Unknown) {
+        stack[top - 1] = stack[top - 1] == True ? False : True;
+      }
+      break;
+    case Op::And:
+      --top;
+      if (stack[top - 1] == False || stack[top] == False) {
+        stack[top - 1] = False;
+      } else if (stack[top - 1] == Unknown || stack[top] == Unknown) {
+        stack[top - 1] = Unknown;
+      } else {
+        stack[top - 1] = True;
+      }
+      break;
+    case Op::Or:
+      --top;
+      if (stack[top - 1] == True || stack[top] == True) {
+        stack[top - 1] = True;
+      } else if (stack[top - 1] == Unknown || stack[top] == Unknown) {
+        stack[top - 1] = Unknown;
+      } else {
+        stack[top - 1] = False;
+      }
+      break;
+    case Op::JumpIfFalse:
+      if (stack[top - 1] == False) {
+        pc = instruction.operand - 1;
+      }
+      break;
+    case Op::JumpIfTrue:
+      if (stack[top - 1] == True) {
+        pc = instruction.operand - 1;
+      }
+      break;
+    }
+  }
+  return top == 0 ? True : stack[top - 1];
+}
+
+bool CursorFilter::matches(CursorContext &context) const {
+  return run(context, false) == True;
+}
+
+static void expansion_position(CXSourceLocation location, CXFile &file,
+                               unsigned &offset) {
+  file = nullptr;
+  offset = 0;
+  clang_getExpansionLocation(location, &file, nullptr, nullptr, &offset);
+}
+
+static void collect_include_site(CXFile, CXSourceLocation *stack,
+                                 unsigned stack_size, CXClientData data) {
+  // the first entry of the stack is the #include directive itself
+  if (stack_size == 0) {
+    return;
+  }
+  CXFile file;
+  unsigned offset;
+  expansion_position(stack[0], file, offset);
+  ((vector<pair<CXFile, unsigned>> *)data)->emplace_back(file, offset);
+}
+
+IncludeSites::IncludeSites(CXTranslationUnit TU) {
+  if (TU != nullptr) {
+    clang_getInclusions(TU, collect_include_site, &sites);
+  }
+  sort(sites.begin(), sites.end());
+}
+
+/*
+ * Also true when the extent can't be pinned down to one file, since then
+ * nothing can be said about what is below it.
+ */
+bool IncludeSites::within(CXSourceRange extent) const {
+  CXFile start_file;
+  CXFile end_file;
+  unsigned start;
+  unsigned end;
+  expansion_position(clang_getRangeStart(extent), start_file, start);
+  expansion_position(clang_getRangeEnd(extent), end_file, end);
+  if (start_file == nullptr || start_file != end_file) {
+    return true;
+  }
+  auto site = lower_bound(sites.begin(), sites.end(),
+                          make_pair(start_file, start));
+  return site != sites.end() && site->first == start_file &&
+         site->second <= end;
+}
+
+/*
+ * The translation unit cursor has no location, so it says nothing about what
+ * is below it.
+ */
+bool CursorFilter::may_match_below(CursorContext &context,
+                                   const IncludeSites &includes) const {
+  if (!prunable || context.kind == CXCursor_TranslationUnit) {
+    return true;
+  }
+  return run(context, true) != False ||
+         includes.within(clang_getCursorExtent(context.cursor));
+}
@@ -0,0 +1,64 @@
+//cursor_filter.h
+#pragma once
+
+#include "cxcursor_info.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * See cursor_filter.cc for more detailed commentary
+ */
+
+/*
+ * Where the #include directives of a translation unit are, to tell whether a
+ * cursor's subtree can reach into another file.
+ */
+class IncludeSites {
+public:
+  explicit IncludeSites(CXTranslationUnit TU);
+  bool within(CXSourceRange extent) const;
+
+private:
+  std::vector<std::pair<CXFile, unsigned>> sites;
+};
+
+class CursorFilter {
+public:
+  CursorFilter() : prunable(false) {}
+  bool compile(const std::string &expression, std::string &error);
+  bool empty() const { return program.empty(); }
+  bool prunes() const { return prunable; }
+  bool matches(CursorContext &context) const;
+  bool may_match_below(CursorContext &context,
+                       const IncludeSites &includes) const;
+
+private:
+  enum class Op : unsigned char {
+    Test,
+    Equal,
+    NotEqual,
+    Not,
+    And,
+    Or,
+    JumpIfFalse,
+    JumpIfTrue
+  };
+
+  struct Instruction {
+    Op op;
+    CursorAttribute attribute;
+    std::uint32_t operand;
+  };
+
+  static const std::size_t max_stack = 32;
+
+  std::vector<Instruction> program;
+  std::vector<std::string> literals;
+  bool prunable;
+
+  friend class FilterCompiler;
+  unsigned char run(CursorContext &context, bool subtree) const;
+};
@@ -0,0 +1,147 @@
+// cursor_id_table.cc
+
+#include "cursor_id_table.h"
+#include "tu_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/* The CustomId of a cursor comes from here.  CursorIdTable is an open
+ * addressing (linear probing) hash table from CXCursor to a 32 bit id, keyed
+ * on clang_hashCursor.  Keeping the hash in the slot means clang_equalCursors
+ * is only called when the hashes already match, and the whole thing is one
+ * flat array, rather than a node per cursor.
+ *
+ * A table only makes sense for one translation unit (cursors from different
+ * ones can't be compared), so it is cleared between them and its memory
+ * doesn't grow with the number of translation units.  When ids have to mean
+ * the same thing across translation units, a cursor with a USR gets its id
+ * from a hash of the USR instead (see usr_cursor_id); cursors without one
+ * still get theirs from the translation unit's count.
+ * */
+
+using namespace std;
+
+static const size_t initial_capacity = 1024;
+
+CursorIdTable::CursorIdTable() : count(0) {}
+
+/*
+ * Slots are marked used by a non zero hash or id.  A cursor hashing to 0 gets
+ * hash 1 instead, which costs nothing but a spurious comparison now and then.
+ */
+static uint32_t slot_hash(CXCursor cursor) {
+  uint32_t hash = clang_hashCursor(cursor);
+  return hash == 0 ? 1 : hash;
+}
+
+void CursorIdTable::grow() {
+  vector<Slot> old_slots(
+      slots.empty() ? initial_capacity : slots.size() * 2, Slot());
+  old_slots.swap(slots);
+  size_t mask = slots.size() - 1;
+  for (auto &&slot : old_slots) {
+    if (!used(slot)) {
+      continue;
+    }
+    size_t i = slot.hash & mask;
+    while (used(slots[i])) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+  }
+}
+
+/*
+ * Returns a reference to the id of the cursor, which is 0 if the cursor
+ * wasn't in the table yet; the caller fills it in.
+ */
+uint32_t &CursorIdTable::id_slot(CXCursor cursor) {
+  // keep the load factor under 3/4
+  if ((count + 1) * 4 > slots.size() * 3) {
+    grow();
+  }
+  uint32_t hash = slot_hash(cursor);
+  size_t mask = slots.size() - 1;
+  size_t i = hash & mask;
+  while (used(slots[i])) {
+    if (slots[i].hash == hash && clang_equalCursors(slots[i].cursor, cursor)) {
+      return slots[i].id;
+    }
+    i = (i + 1) & mask;
+  }
+  slots[i].cursor = cursor;
+  slots[i].hash = hash;
+  slots[i].id = 0;
+  ++count;
+  return slots[i].id;
+}
+
+/*
+ * Keep the capacity around for the next translation unit, unless it was grown
+ * for an unusually big one and this one used less than an eighth of it: then
+ * the table is freed, rather than every small translation unit after the big
+ * one paying to clear all of it.
+ */
+void CursorIdTable::clear() {
+  if (slots.size() > initial_capacity && count * 8 < slots.size()) {
+    vector<Slot>().swap(slots);
+  } else {
+    fill(slots.begin(), slots.end(), Slot());
+  }
+  count = 0;
+}
+
+/*
+ * Give the memory back, for runs that would rather not keep it (see
+ * --memory-budget).
+ */
+void CursorIdTable::release() {
+  vector<Slot>().swap(slots);
+  count = 0;
+}
+
+/*
+ * The id of a USR is a hash of it, so it comes out the same whatever thread
+ * gets to the USR first, and in every run, shard and translation unit.  The
+ * top bit is always set, which keeps the ids clear of the ones counted up
+ * per translation unit for cursors without a USR.  31 bits do collide now
+ * and then in a big project: the USRs seen are kept (shared by every thread,
+ * so behind a mutex) to say so on stderr, where the two symbols share an id.
+ * Returns 0 for a cursor without a USR.
+ */
+static mutex usr_id_mutex;
+static unordered_map<uint32_t, string> usr_id_table;
+static unordered_set<string> colliding_usrs;
+
+uint32_t usr_cursor_id(CXCursor cursor) {
+  CXString cxusr = clang_getCursorUSR(cursor);
+  const char *usr = clang_getCString(cxusr);
+  if (usr == nullptr || *usr == '\0') {
+    clang_disposeString(cxusr);
+    return 0;
+  }
+  ContentHash hash = hash_bytes(usr, strlen(usr));
+  uint32_t id = (uint32_t)(hash ^ (hash >> 32)) | usr_id_bit;
+  {
+    lock_guard<mutex> lock(usr_id_mutex);
+    auto inserted = usr_id_table.emplace(id, usr);
+    if (!inserted.second && inserted.first->second != usr &&
+        colliding_usrs.insert(usr).second) {
+      cerr << "USRs " << inserted.first->second << " and " << usr
+           << " share the id " << id << endl;
+    }
+  }
+  clang_disposeString(cxusr);
+  return id;
+}
+
+size_t usr_id_table_size(void) {
+  lock_guard<mutex> lock(usr_id_mutex);
+  return usr_id_table.size();
+}
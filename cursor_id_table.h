@@ -0,0 +1,38 @@
+//cursor_id_table.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * See cursor_id_table.cc for more detailed commentary
+ */
+
+class CursorIdTable {
+public:
+  CursorIdTable();
+  std::uint32_t &id_slot(CXCursor cursor);
+  std::size_t size() const { return count; }
+  std::size_t memory() const { return slots.capacity() * sizeof(Slot); }
+  void clear();
+  void release();
+
+private:
+  struct Slot {
+    CXCursor cursor;
+    std::uint32_t hash;
+    std::uint32_t id;
+  };
+  std::vector<Slot> slots;
+  std::size_t count;
+  bool used(const Slot &slot) const { return slot.hash != 0 || slot.id != 0; }
+  void grow();
+};
+
+// set in the ids of USRs, and in no id counted within a translation unit
+static const std::uint32_t usr_id_bit = 0x80000000u;
+
+std::uint32_t usr_cursor_id(CXCursor cursor);
+std::size_t usr_id_table_size(void);
@@ -1,10 +1,30 @@
 // cxcursor_info.cc
 
 #include "cxcursor_info.h"
+#include "columnar_dump.h"
+#include "cursor_id_table.h"
+#include "declaration_set.h"
+#include "index_backend.h"
+#include "location_queries.h"
+#include "mem_stats.h"
 #include "parse_cxcursor_info_options.h"
+#include "output_sink.h"
+#include "profiler.h"
+#include "project_mode.h"
+#include "query_daemon.h"
+#include "session_mode.h"
+#include "shard_merge.h"
+#include "symbol_index.h"
+#include "tu_cache.h"
 
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <list>
+#include <vector>
+
+#include <unistd.h>
 
 /* This provides a basic command line interface to get all the cursor
  * information you would probably ever need that libclang provides.  There are a
@@ -27,7 +47,6 @@
  * */
 
 using namespace std;
-using AttributeMap = std::unordered_map<std::string, std::string (*)(CXCursor)>;
 
 /// Helper functions...
 std::size_t get_offset(std::size_t size, std::size_t align = 30) {
@@ -77,561 +96,1021 @@ std::string string_location(CXSourceLocation location) {
 /// End Helper functions
 
 /*
- * Maintain a table of unique ids for each cursor.
- * This is used for cross referencing different cursors (e.g. when a cursor is
- * defined by another).
+ * The text of a Text value, null for a null CXString.
  */
-struct CursorHash {
-  size_t operator()(CXCursor cursor) const { return clang_hashCursor(cursor); }
-};
-struct CursorEqual {
-  size_t operator()(CXCursor lhs, CXCursor rhs) const {
-    return clang_equalCursors(lhs, rhs);
+const char *value_text(const AttributeValue &value) {
+  if (value.detached) {
+    return value.copied.c_str();
   }
-};
-static std::size_t custom_uid = 0;
-static std::unordered_map<CXCursor, std::string, CursorHash, CursorEqual>
-    id_table;
+  return value.cxstring.data == nullptr ? nullptr
+                                        : clang_getCString(value.cxstring);
+}
+
+void append_json_value(std::string &result, const AttributeValue &value) {
+  switch (value.kind) {
+  case AttributeValue::Null:
+    result += "null";
+    break;
+  case AttributeValue::Bool:
+    result += value.number ? "true" : "false";
+    break;
+  case AttributeValue::Integer:
+  case AttributeValue::Id:
+    append_value(result, value);
+    break;
+  case AttributeValue::Text: {
+    const char *text = value_text(value);
+    if (text == nullptr) {
+      result += "null";
+    } else {
+      append_json_string(result, text);
+    }
+  } break;
+  default: {
+    std::string text;
+    append_value(text, value);
+    append_json_string(result, text.c_str());
+  }
+  }
+}
 
 /*
- * The cursor information is provided by "attributes" and "predicates."
- *
- * All functions which retrieve attributes are prefixed by cursor_attribute_ and
- * then a descriptive name.  All attribute retrieving functions take a CXCursor
- * as an argument, and return a string.
- *
- * All functions which answer a predicate query are prefixed by
- * cursor_predicate_ and a descriptive name.  All predicate functions take a
- * CXCursor as an argument, and return a string of either "T" * or "F"
- * indicating true or false, repsectively.
+ * CursorContext looks up the things several attributes share the first time
+ * one of them asks, so selecting every attribute costs one clang_getCursorType
+ * per cursor rather than one per type attribute.
  */
-std::string cursor_attribute_CustomId(CXCursor cursor) {
-  auto it = id_table.find(cursor);
-  if (it != id_table.end()) {
-    return it->second;
-  } else {
-    std::string new_id = to_string(++custom_uid);
-    id_table[cursor] = new_id;
-    return new_id;
+CursorContext::CursorContext(CXCursor c)
+    : cursor(c), kind(c.kind), have_type(false), have_location(false),
+      have_spelling_location(false) {}
+
+CXType CursorContext::type() {
+  if (!have_type) {
+    cursor_type = clang_getCursorType(cursor);
+    have_type = true;
   }
+  return cursor_type;
 }
-std::string cursor_attribute_TypeSpelling(CXCursor cursor) {
-  return convert_cxstring(clang_getTypeSpelling(clang_getCursorType(cursor)));
+
+CXSourceLocation CursorContext::location() {
+  if (!have_location) {
+    cursor_location = clang_getCursorLocation(cursor);
+    have_location = true;
+  }
+  return cursor_location;
 }
-std::string cursor_attribute_TypeKindSpelling(CXCursor cursor) {
-  return convert_cxstring(
-      clang_getTypeKindSpelling(clang_getCursorType(cursor).kind));
+
+const SpellingLocation &CursorContext::spelling_location() {
+  if (!have_spelling_location) {
+    clang_getSpellingLocation(location(), &spelling.file, &spelling.line,
+                              &spelling.col, nullptr);
+    have_spelling_location = true;
+  }
+  return spelling;
 }
-std::string cursor_attribute_CursorUSR(CXCursor cursor) {
-  return convert_cxstring(clang_getCursorUSR(cursor));
+
+/*
+ * AttributeValue keeps a value in the form libclang gave it to us.  Only text
+ * values own anything (their CXString), and they hand it over when moved.
+ * Once detached, a value holds no CXString and no CXFile any more.
+ */
+AttributeValue::AttributeValue()
+    : kind(Null), number(0), cxstring{nullptr, 0}, file(nullptr), line(0),
+      col(0), detached(false) {}
+
+AttributeValue::AttributeValue(AttributeValue &&other)
+    : kind(other.kind), number(other.number), cxstring(other.cxstring),
+      file(other.file), line(other.line), col(other.col),
+      detached(other.detached), copied(std::move(other.copied)) {
+  other.kind = Null;
 }
-std::string cursor_attribute_CursorSpelling(CXCursor cursor) {
-  return convert_cxstring(clang_getCursorSpelling(cursor));
+
+AttributeValue &AttributeValue::operator=(AttributeValue &&other) {
+  if (this != &other) {
+    if (kind == Text && cxstring.data != nullptr) {
+      clang_disposeString(cxstring);
+    }
+    kind = other.kind;
+    number = other.number;
+    cxstring = other.cxstring;
+    file = other.file;
+    line = other.line;
+    col = other.col;
+    detached = other.detached;
+    copied = std::move(other.copied);
+    other.kind = Null;
+  }
+  return *this;
 }
-std::string cursor_attribute_CursorDisplayName(CXCursor cursor) {
-  return convert_cxstring(clang_getCursorDisplayName(cursor));
+
+AttributeValue::~AttributeValue() {
+  if (kind == Text && cxstring.data != nullptr) {
+    clang_disposeString(cxstring);
+  }
 }
-std::string cursor_attribute_CursorKindSpelling(CXCursor cursor) {
-  return convert_cxstring(clang_getCursorKindSpelling(cursor.kind));
+
+/*
+ * A null CXString or CXFile refers to nothing, so it is left as it is.
+ */
+void AttributeValue::detach() {
+  if (kind == Text && cxstring.data != nullptr) {
+    const char *text = clang_getCString(cxstring);
+    copied = text == nullptr ? "" : text;
+    clang_disposeString(cxstring);
+    cxstring = CXString{nullptr, 0};
+    detached = true;
+  } else if (kind == Location && file != nullptr) {
+    CXString file_name = clang_getFileName(file);
+    const char *name = clang_getCString(file_name);
+    copied = name == nullptr ? "" : name;
+    clang_disposeString(file_name);
+    file = nullptr;
+    detached = true;
+  }
 }
-std::string cursor_attribute_RawCommentText(CXCursor cursor) {
-  return convert_cxstring(clang_Cursor_getRawCommentText(cursor));
+
+AttributeValue AttributeValue::null() { return AttributeValue(); }
+
+AttributeValue AttributeValue::boolean(bool value) {
+  AttributeValue result;
+  result.kind = Bool;
+  result.number = value;
+  return result;
 }
-std::string cursor_attribute_BriefCommentText(CXCursor cursor) {
-  return convert_cxstring(clang_Cursor_getBriefCommentText(cursor));
+
+AttributeValue AttributeValue::integer(long long value) {
+  AttributeValue result;
+  result.kind = Integer;
+  result.number = value;
+  return result;
 }
-std::string cursor_attribute_Mangling(CXCursor cursor) {
-  return convert_cxstring(clang_Cursor_getMangling(cursor));
+
+AttributeValue AttributeValue::id(std::uint32_t value) {
+  AttributeValue result;
+  result.kind = Id;
+  result.number = (long long)value;
+  return result;
 }
-std::string cursor_attribute_location(CXCursor cursor) {
-  return string_location(clang_getCursorLocation(cursor));
+
+AttributeValue AttributeValue::text(CXString value) {
+  AttributeValue result;
+  result.kind = Text;
+  result.cxstring = value;
+  return result;
 }
-std::string cursor_attribute_SemanticParent(CXCursor cursor) {
-  CXCursor next = clang_getCursorSemanticParent(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
-  }
+
+AttributeValue AttributeValue::copied_text(const std::string &value) {
+  AttributeValue result;
+  result.kind = Text;
+  result.detached = true;
+  result.copied = value;
+  return result;
 }
-std::string cursor_attribute_LexicalParent(CXCursor cursor) {
-  CXCursor next = clang_getCursorLexicalParent(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
-  }
+
+AttributeValue AttributeValue::location(CXFile file, unsigned line,
+                                        unsigned col) {
+  AttributeValue result;
+  result.kind = Location;
+  result.file = file;
+  result.line = line;
+  result.col = col;
+  return result;
 }
-std::string cursor_attribute_Referenced(CXCursor cursor) {
-  CXCursor next = clang_getCursorReferenced(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
-  }
+
+AttributeValue AttributeValue::ref_qualifier(CXRefQualifierKind value) {
+  AttributeValue result;
+  result.kind = RefQualifier;
+  result.number = value;
+  return result;
 }
-std::string cursor_attribute_Definition(CXCursor cursor) {
-  CXCursor next = clang_getCursorDefinition(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
-  }
+
+AttributeValue AttributeValue::storage_class(CX_StorageClass value) {
+  AttributeValue result;
+  result.kind = StorageClass;
+  result.number = value;
+  return result;
 }
-std::string cursor_attribute_CanonicalCursor(CXCursor cursor) {
-  CXCursor next = clang_getCanonicalCursor(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
+
+const char *string_RefQualifier(long long ref_qualifier) {
+  switch (ref_qualifier) {
+  case CXRefQualifier_None:
+    return "None";
+  case CXRefQualifier_LValue:
+    return "LValue";
+  case CXRefQualifier_RValue:
+    return "RValue";
+  default:
+    return "fail";
   }
 }
-std::string cursor_attribute_SpecializedCursorTemplate(CXCursor cursor) {
-  CXCursor next = clang_getSpecializedCursorTemplate(cursor);
-  if (!clang_Cursor_isNull(next)) {
-    return cursor_attribute_CustomId(next);
-  } else {
-    return "-1";
+
+const char *string_StorageClass(long long storage_class) {
+  switch (storage_class) {
+  case CX_SC_Invalid:
+    return "Invalid";
+  case CX_SC_None:
+    return "None";
+  case CX_SC_Extern:
+    return "Extern";
+  case CX_SC_Static:
+    return "Static";
+  case CX_SC_PrivateExtern:
+    return "PrivateExtern";
+  case CX_SC_OpenCLWorkGroupLocal:
+    return "OpenCLWorkGroupLocal";
+  case CX_SC_Auto:
+    return "Auto";
+  case CX_SC_Register:
+    return "Register";
+  default:
+    return "fail";
   }
 }
 
 /*
- * cursor predicates
+ * These are the values that used to come back as "", "None", "fail",
+ * "null cxstring", "-1" or "F", which are hidden unless --verbose is given.
  */
-std::string cursor_predicate_hasAttributes(CXCursor cursor) {
-  if (clang_Cursor_hasAttrs(cursor)) {
-    return "T";
+bool meaningless_value(const AttributeValue &value) {
+  switch (value.kind) {
+  case AttributeValue::Null:
+    return true;
+  case AttributeValue::Bool:
+    return value.number == 0;
+  case AttributeValue::Integer:
+    return value.number == -1;
+  case AttributeValue::Id:
+  case AttributeValue::Location:
+    return false;
+  case AttributeValue::Text: {
+    const char *text = value_text(value);
+    return text == nullptr || *text == '\0';
   }
-  return "F";
-}
-std::string cursor_predicate_isInSystemHeader(CXCursor cursor) {
-  CXSourceLocation location = clang_getCursorLocation(cursor);
-  if (clang_Location_isInSystemHeader(location)) {
-    return "T";
+  case AttributeValue::RefQualifier:
+    return value.number != CXRefQualifier_LValue &&
+           value.number != CXRefQualifier_RValue;
+  case AttributeValue::StorageClass: {
+    const char *name = string_StorageClass(value.number);
+    return strcmp(name, "None") == 0 || strcmp(name, "fail") == 0;
   }
-  return "F";
-}
-std::string cursor_predicate_isFromMainFile(CXCursor cursor) {
-  CXSourceLocation location = clang_getCursorLocation(cursor);
-  if (clang_Location_isFromMainFile(location)) {
-    return "T";
   }
-  return "F";
+  return true;
 }
-std::string cursor_predicate_isDeclaration(CXCursor cursor) {
-  if (clang_isDeclaration(cursor.kind)) {
-    return "T";
+
+/*
+ * This (and append_json_value) is the only place a value is turned into text.
+ */
+void append_value(std::string &result, const AttributeValue &value) {
+  char buffer[32];
+  switch (value.kind) {
+  case AttributeValue::Null:
+    result += "-1";
+    break;
+  case AttributeValue::Bool:
+    result += value.number ? 'T' : 'F';
+    break;
+  case AttributeValue::Integer:
+  case AttributeValue::Id:
+    snprintf(buffer, sizeof(buffer), "%lld", value.number);
+    result += buffer;
+    break;
+  case AttributeValue::Text: {
+    const char *text = value_text(value);
+    result += text == nullptr ? "null cxstring" : text;
+  } break;
+  case AttributeValue::Location: {
+    if (value.detached) {
+      result += value.copied;
+    } else if (value.file == nullptr) {
+      result += "no location";
+      break;
+    } else {
+      CXString file_name = clang_getFileName(value.file);
+      const char *name = clang_getCString(file_name);
+      result += name == nullptr ? "" : name;
+      clang_disposeString(file_name);
+    }
+    snprintf(buffer, sizeof(buffer), ":%u:%u", value.line, value.col);
+    result += buffer;
+  } break;
+  case AttributeValue::RefQualifier:
+    result += string_RefQualifier(value.number);
+    break;
+  case AttributeValue::StorageClass:
+    result += string_StorageClass(value.number);
+    break;
   }
-  return "F";
 }
-std::string cursor_predicate_isReference(CXCursor cursor) {
-  if (clang_isReference(cursor.kind)) {
-    return "T";
-  }
-  return "F";
+
+/*
+ * Maintain a table of unique ids for each cursor.
+ * This is used for cross referencing different cursors (e.g. when a cursor is
+ * defined by another).  The table is per thread, and is reset for each
+ * translation unit so the numbering doesn't depend on scheduling.  With
+ * --usr-ids, cursors that have a USR get the same id in every translation
+ * unit instead (see cursor_id_table.cc), and the rest are still counted.
+ */
+static thread_local std::uint32_t custom_uid = 0;
+static thread_local CursorIdTable id_table;
+static bool usr_ids = false;
+
+void use_usr_ids(bool use) { usr_ids = use; }
+
+void reset_id_table(void) {
+  custom_uid = 0;
+  id_table.clear();
 }
-std::string cursor_predicate_isExpression(CXCursor cursor) {
-  if (clang_isExpression(cursor.kind)) {
-    return "T";
-  }
-  return "F";
+
+void release_id_table(void) {
+  custom_uid = 0;
+  id_table.release();
 }
-std::string cursor_predicate_isStatement(CXCursor cursor) {
-  if (clang_isStatement(cursor.kind)) {
-    return "T";
+
+std::size_t id_table_size(void) { return id_table.size(); }
+
+std::size_t id_table_memory(void) { return id_table.memory(); }
+
+/*
+ * The cursor information is provided by "attributes" and "predicates."
+ *
+ * All functions which retrieve attributes are prefixed by cursor_attribute_ and
+ * then a descriptive name.  All attribute retrieving functions take a CXCursor
+ * as an argument, and return an AttributeValue holding whatever libclang
+ * handed back (a CXString, a number, an enum...).
+ *
+ * All functions which answer a predicate query are prefixed by
+ * cursor_predicate_ and a descriptive name.  All predicate functions take a
+ * CXCursor as an argument, and return a boolean AttributeValue, which is
+ * written out as "T" or "F".
+ */
+std::uint32_t cursor_id(CXCursor cursor) {
+  std::uint32_t &id = id_table.id_slot(cursor);
+  if (id == 0) {
+    id = usr_ids ? usr_cursor_id(cursor) : 0;
+    if (id == 0) {
+      id = ++custom_uid;
+    }
   }
-  return "F";
+  return id;
 }
-std::string cursor_predicate_isAttribute(CXCursor cursor) {
-  if (clang_isAttribute(cursor.kind)) {
-    return "T";
+static AttributeValue cursor_reference(CXCursor next) {
+  if (!clang_Cursor_isNull(next)) {
+    return AttributeValue::id(cursor_id(next));
   }
-  return "F";
+  return AttributeValue::null();
 }
-std::string cursor_predicate_isInvalid(CXCursor cursor) {
-  if (clang_isInvalid(cursor.kind)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_attribute_CustomId(CursorContext &context) {
+  return AttributeValue::id(cursor_id(context.cursor));
+}
+AttributeValue cursor_attribute_TypeSpelling(CursorContext &context) {
+  return AttributeValue::text(clang_getTypeSpelling(context.type()));
 }
-std::string cursor_predicate_isTranslationUnit(CXCursor cursor) {
-  if (clang_isTranslationUnit(cursor.kind)) {
-    return "T";
+AttributeValue cursor_attribute_TypeKindSpelling(CursorContext &context) {
+  return AttributeValue::text(clang_getTypeKindSpelling(context.type().kind));
+}
+AttributeValue cursor_attribute_CursorUSR(CursorContext &context) {
+  return AttributeValue::text(clang_getCursorUSR(context.cursor));
+}
+/*
+ * A translation unit loaded from the -c cache is spelled the way it was when
+ * it was parsed (see tu_cache.cc).
+ */
+static bool cached_translation_unit_spelling(CursorContext &context,
+                                             AttributeValue &value) {
+  std::string spelling;
+  if (context.kind != CXCursor_TranslationUnit ||
+      !cached_spelling(clang_Cursor_getTranslationUnit(context.cursor),
+                       spelling)) {
+    return false;
   }
-  return "F";
+  value = AttributeValue::copied_text(spelling);
+  return true;
 }
-std::string cursor_predicate_isPreprocessing(CXCursor cursor) {
-  if (clang_isPreprocessing(cursor.kind)) {
-    return "T";
+AttributeValue cursor_attribute_CursorSpelling(CursorContext &context) {
+  AttributeValue value;
+  if (cached_translation_unit_spelling(context, value)) {
+    return value;
   }
-  return "F";
+  return AttributeValue::text(clang_getCursorSpelling(context.cursor));
 }
-std::string cursor_predicate_isUnexposed(CXCursor cursor) {
-  if (clang_isUnexposed(cursor.kind)) {
-    return "T";
+AttributeValue cursor_attribute_CursorDisplayName(CursorContext &context) {
+  AttributeValue value;
+  if (cached_translation_unit_spelling(context, value)) {
+    return value;
   }
-  return "F";
+  return AttributeValue::text(clang_getCursorDisplayName(context.cursor));
+}
+AttributeValue cursor_attribute_CursorKindSpelling(CursorContext &context) {
+  return AttributeValue::text(clang_getCursorKindSpelling(context.kind));
+}
+AttributeValue cursor_attribute_RawCommentText(CursorContext &context) {
+  return AttributeValue::text(clang_Cursor_getRawCommentText(context.cursor));
+}
+AttributeValue cursor_attribute_BriefCommentText(CursorContext &context) {
+  return AttributeValue::text(clang_Cursor_getBriefCommentText(context.cursor));
+}
+AttributeValue cursor_attribute_Mangling(CursorContext &context) {
+  return AttributeValue::text(clang_Cursor_getMangling(context.cursor));
+}
+AttributeValue cursor_attribute_location(CursorContext &context) {
+  const SpellingLocation &spelling = context.spelling_location();
+  return AttributeValue::location(spelling.file, spelling.line, spelling.col);
+}
+AttributeValue cursor_attribute_SemanticParent(CursorContext &context) {
+  return cursor_reference(clang_getCursorSemanticParent(context.cursor));
+}
+AttributeValue cursor_attribute_LexicalParent(CursorContext &context) {
+  return cursor_reference(clang_getCursorLexicalParent(context.cursor));
+}
+AttributeValue cursor_attribute_Referenced(CursorContext &context) {
+  return cursor_reference(clang_getCursorReferenced(context.cursor));
+}
+AttributeValue cursor_attribute_Definition(CursorContext &context) {
+  return cursor_reference(clang_getCursorDefinition(context.cursor));
+}
+AttributeValue cursor_attribute_CanonicalCursor(CursorContext &context) {
+  return cursor_reference(clang_getCanonicalCursor(context.cursor));
+}
+AttributeValue
+cursor_attribute_SpecializedCursorTemplate(CursorContext &context) {
+  return cursor_reference(clang_getSpecializedCursorTemplate(context.cursor));
+}
+
+/*
+ * cursor predicates
+ */
+AttributeValue cursor_predicate_hasAttributes(CursorContext &context) {
+  return AttributeValue::boolean(clang_Cursor_hasAttrs(context.cursor));
+}
+AttributeValue cursor_predicate_isInSystemHeader(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_Location_isInSystemHeader(context.location()));
+}
+AttributeValue cursor_predicate_isFromMainFile(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_Location_isFromMainFile(context.location()));
+}
+AttributeValue cursor_predicate_isDeclaration(CursorContext &context) {
+  return AttributeValue::boolean(clang_isDeclaration(context.kind));
+}
+AttributeValue cursor_predicate_isReference(CursorContext &context) {
+  return AttributeValue::boolean(clang_isReference(context.kind));
+}
+AttributeValue cursor_predicate_isExpression(CursorContext &context) {
+  return AttributeValue::boolean(clang_isExpression(context.kind));
+}
+AttributeValue cursor_predicate_isStatement(CursorContext &context) {
+  return AttributeValue::boolean(clang_isStatement(context.kind));
+}
+AttributeValue cursor_predicate_isAttribute(CursorContext &context) {
+  return AttributeValue::boolean(clang_isAttribute(context.kind));
+}
+AttributeValue cursor_predicate_isInvalid(CursorContext &context) {
+  return AttributeValue::boolean(clang_isInvalid(context.kind));
+}
+AttributeValue cursor_predicate_isTranslationUnit(CursorContext &context) {
+  return AttributeValue::boolean(clang_isTranslationUnit(context.kind));
+}
+AttributeValue cursor_predicate_isPreprocessing(CursorContext &context) {
+  return AttributeValue::boolean(clang_isPreprocessing(context.kind));
+}
+AttributeValue cursor_predicate_isUnexposed(CursorContext &context) {
+  return AttributeValue::boolean(clang_isUnexposed(context.kind));
 }
 
 //
-std::string cursor_predicate_isMacroFunctionLike(CXCursor cursor) {
-  if (clang_Cursor_isMacroFunctionLike(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isMacroFunctionLike(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_Cursor_isMacroFunctionLike(context.cursor));
 }
-std::string cursor_predicate_isMacroBuiltin(CXCursor cursor) {
-  if (clang_Cursor_isMacroBuiltin(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isMacroBuiltin(CursorContext &context) {
+  return AttributeValue::boolean(clang_Cursor_isMacroBuiltin(context.cursor));
 }
-std::string cursor_predicate_isFunctionInlined(CXCursor cursor) {
-  if (clang_Cursor_isFunctionInlined(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isFunctionInlined(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_Cursor_isFunctionInlined(context.cursor));
 }
-std::string cursor_predicate_isBitField(CXCursor cursor) {
-  if (clang_Cursor_isBitField(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isBitField(CursorContext &context) {
+  return AttributeValue::boolean(clang_Cursor_isBitField(context.cursor));
 }
-std::string cursor_predicate_isDynamicCall(CXCursor cursor) {
-  if (clang_Cursor_isDynamicCall(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isDynamicCall(CursorContext &context) {
+  return AttributeValue::boolean(clang_Cursor_isDynamicCall(context.cursor));
 }
-std::string cursor_predicate_isVariadic(CXCursor cursor) {
-  if (clang_Cursor_isVariadic(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isVariadic(CursorContext &context) {
+  return AttributeValue::boolean(clang_Cursor_isVariadic(context.cursor));
 }
-std::string cursor_predicate_isConvertingConstructor(CXCursor cursor) {
-  if (clang_CXXConstructor_isConvertingConstructor(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue
+cursor_predicate_isConvertingConstructor(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_CXXConstructor_isConvertingConstructor(context.cursor));
 }
-std::string cursor_predicate_isCopyConstructor(CXCursor cursor) {
-  if (clang_CXXConstructor_isCopyConstructor(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isCopyConstructor(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_CXXConstructor_isCopyConstructor(context.cursor));
 }
-std::string cursor_predicate_isDefaultConstructor(CXCursor cursor) {
-  if (clang_CXXConstructor_isDefaultConstructor(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isDefaultConstructor(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_CXXConstructor_isDefaultConstructor(context.cursor));
 }
-std::string cursor_predicate_isMoveConstructor(CXCursor cursor) {
-  if (clang_CXXConstructor_isMoveConstructor(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isMoveConstructor(CursorContext &context) {
+  return AttributeValue::boolean(
+      clang_CXXConstructor_isMoveConstructor(context.cursor));
 }
-std::string cursor_predicate_isMutable(CXCursor cursor) {
-  if (clang_CXXField_isMutable(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isMutable(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXField_isMutable(context.cursor));
 }
-std::string cursor_predicate_isDefaulted(CXCursor cursor) {
-  if (clang_CXXMethod_isDefaulted(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isDefaulted(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXMethod_isDefaulted(context.cursor));
 }
-std::string cursor_predicate_isCursorDefinition(CXCursor cursor) {
-  if (clang_isCursorDefinition(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isCursorDefinition(CursorContext &context) {
+  return AttributeValue::boolean(clang_isCursorDefinition(context.cursor));
 }
-std::string cursor_predicate_isPureVirtual(CXCursor cursor) {
-  if (clang_CXXMethod_isPureVirtual(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isPureVirtual(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXMethod_isPureVirtual(context.cursor));
 }
-std::string cursor_predicate_isStatic(CXCursor cursor) {
-  if (clang_CXXMethod_isStatic(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isStatic(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXMethod_isStatic(context.cursor));
 }
-std::string cursor_predicate_isVirtual(CXCursor cursor) {
-  if (clang_CXXMethod_isVirtual(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isVirtual(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXMethod_isVirtual(context.cursor));
 }
-std::string cursor_predicate_isVirtualBase(CXCursor cursor) {
-  if (clang_isVirtualBase(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isVirtualBase(CursorContext &context) {
+  return AttributeValue::boolean(clang_isVirtualBase(context.cursor));
 }
-std::string cursor_predicate_isConst(CXCursor cursor) {
-  if (clang_CXXMethod_isConst(cursor)) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isConst(CursorContext &context) {
+  return AttributeValue::boolean(clang_CXXMethod_isConst(context.cursor));
 }
 
-std::string cursor_attribute_getClassType(CXCursor cursor) {
-  return convert_cxstring(clang_getTypeSpelling(
-      clang_Type_getClassType(clang_getCursorType(cursor))));
+AttributeValue cursor_attribute_getClassType(CursorContext &context) {
+  return AttributeValue::text(
+      clang_getTypeSpelling(clang_Type_getClassType(context.type())));
 }
-std::string cursor_attribute_getNamedType(CXCursor cursor) {
-  return convert_cxstring(clang_getTypeSpelling(
-      clang_Type_getNamedType(clang_getCursorType(cursor))));
+AttributeValue cursor_attribute_getNamedType(CursorContext &context) {
+  return AttributeValue::text(
+      clang_getTypeSpelling(clang_Type_getNamedType(context.type())));
 }
 
-std::string cursor_predicate_isConstQualifiedType(CXCursor cursor) {
-  if (clang_isConstQualifiedType(clang_getCursorType(cursor))) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isConstQualifiedType(CursorContext &context) {
+  return AttributeValue::boolean(clang_isConstQualifiedType(context.type()));
 }
-std::string cursor_predicate_isVolatileQualifiedType(CXCursor cursor) {
-  if (clang_isVolatileQualifiedType(clang_getCursorType(cursor))) {
-    return "T";
-  }
-  return "F";
+AttributeValue
+cursor_predicate_isVolatileQualifiedType(CursorContext &context) {
+  return AttributeValue::boolean(clang_isVolatileQualifiedType(context.type()));
 }
-std::string cursor_predicate_isRestrictQualifiedType(CXCursor cursor) {
-  if (clang_isRestrictQualifiedType(clang_getCursorType(cursor))) {
-    return "T";
-  }
-  return "F";
+AttributeValue
+cursor_predicate_isRestrictQualifiedType(CursorContext &context) {
+  return AttributeValue::boolean(clang_isRestrictQualifiedType(context.type()));
 }
-std::string cursor_predicate_isFunctionTypeVariadic(CXCursor cursor) {
-  if (clang_isFunctionTypeVariadic(clang_getCursorType(cursor))) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isFunctionTypeVariadic(CursorContext &context) {
+  return AttributeValue::boolean(clang_isFunctionTypeVariadic(context.type()));
 }
-std::string cursor_predicate_isPODType(CXCursor cursor) {
-  if (clang_isPODType(clang_getCursorType(cursor))) {
-    return "T";
-  }
-  return "F";
+AttributeValue cursor_predicate_isPODType(CursorContext &context) {
+  return AttributeValue::boolean(clang_isPODType(context.type()));
 }
 
-std::string cursor_attribute_getAlignOf(CXCursor cursor) {
-  return std::to_string(clang_Type_getAlignOf(clang_getCursorType(cursor)));
+AttributeValue cursor_attribute_getAlignOf(CursorContext &context) {
+  return AttributeValue::integer(clang_Type_getAlignOf(context.type()));
 }
-std::string cursor_attribute_getSizeOf(CXCursor cursor) {
-  return std::to_string(clang_Type_getSizeOf(clang_getCursorType(cursor)));
+AttributeValue cursor_attribute_getSizeOf(CursorContext &context) {
+  return AttributeValue::integer(clang_Type_getSizeOf(context.type()));
 }
 
-std::string cursor_attribute_getNumArguments(CXCursor cursor) {
-  return std::to_string(clang_Cursor_getNumArguments(cursor));
+AttributeValue cursor_attribute_getNumArguments(CursorContext &context) {
+  return AttributeValue::integer(clang_Cursor_getNumArguments(context.cursor));
 }
 
-std::string cursor_attribute_getNumTemplateArguments(CXCursor cursor) {
-  return std::to_string(clang_Cursor_getNumTemplateArguments(cursor));
+AttributeValue
+cursor_attribute_getNumTemplateArguments(CursorContext &context) {
+  return AttributeValue::integer(
+      clang_Cursor_getNumTemplateArguments(context.cursor));
 }
 
-std::string cursor_attribute_getCXXRefQualifier(CXCursor cursor) {
-  switch (clang_Type_getCXXRefQualifier(clang_getCursorType(cursor))) {
-  case CXRefQualifier_None: {
-    return "None";
-  } break;
-  case CXRefQualifier_LValue: {
-    return "LValue";
-  } break;
-  case CXRefQualifier_RValue: {
-    return "RValue";
-  } break;
-  default:
-    return "fail";
-  }
+AttributeValue cursor_attribute_getCXXRefQualifier(CursorContext &context) {
+  return AttributeValue::ref_qualifier(
+      clang_Type_getCXXRefQualifier(context.type()));
 }
 
-std::string cursor_attribute_getStorageClass(CXCursor cursor) {
-  switch (clang_Cursor_getStorageClass(cursor)) {
-  case CX_SC_Invalid: {
-    return "Invalid";
-  } break;
-  case CX_SC_None: {
-    return "None";
-  } break;
-  case CX_SC_Extern: {
-    return "Extern";
-  } break;
-  case CX_SC_Static: {
-    return "Static";
-  } break;
-  case CX_SC_PrivateExtern: {
-    return "PrivateExtern";
-  } break;
-  case CX_SC_OpenCLWorkGroupLocal: {
-    return "OpenCLWorkGroupLocal";
-  } break;
-  case CX_SC_Auto: {
-    return "Auto";
-  } break;
-  case CX_SC_Register: {
-    return "Register";
-  } break;
-  default:
-    return "fail";
-  }
+AttributeValue cursor_attribute_getStorageClass(CursorContext &context) {
+  return AttributeValue::storage_class(
+      clang_Cursor_getStorageClass(context.cursor));
 }
 
 /*
- * This map refers attribute (or predicate) names to the value retrieving
- * function above.
+ * This table refers attribute (or predicate) names to the value retrieving
+ * function above.  It is indexed by CursorAttribute, so the entries have to
+ * stay in the same order as the enum (checked below).
  */
-AttributeMap cursor_attribute_map = {
-    {"CustomId", cursor_attribute_CustomId},
-    {"TypeSpelling", cursor_attribute_TypeSpelling},
-    {"TypeKindSpelling", cursor_attribute_TypeKindSpelling},
-    {"CursorUSR", cursor_attribute_CursorUSR},
-    {"CursorSpelling", cursor_attribute_CursorSpelling},
-    {"CursorDisplayName", cursor_attribute_CursorDisplayName},
-    {"CursorKindSpelling", cursor_attribute_CursorKindSpelling},
-    {"RawCommentText", cursor_attribute_RawCommentText},
-    {"BriefCommentText", cursor_attribute_BriefCommentText},
-    {"location", cursor_attribute_location},
-    {"SemanticParent", cursor_attribute_SemanticParent},
-    {"LexicalParent", cursor_attribute_LexicalParent},
-    {"Referenced", cursor_attribute_Referenced},
-    {"Definition", cursor_attribute_Definition},
-    {"CanonicalCursor", cursor_attribute_CanonicalCursor},
-    {"SpecializedCursorTemplate", cursor_attribute_SpecializedCursorTemplate},
-    {"hasAttributes", cursor_predicate_hasAttributes},
-    {"isInSystemHeader", cursor_predicate_isInSystemHeader},
-    {"isFromMainFile", cursor_predicate_isFromMainFile},
-    {"isDeclaration", cursor_predicate_isDeclaration},
-    {"isReference", cursor_predicate_isReference},
-    {"isExpression", cursor_predicate_isExpression},
-    {"isStatement", cursor_predicate_isStatement},
-    {"isAttribute", cursor_predicate_isAttribute},
-    {"isInvalid", cursor_predicate_isInvalid},
-    {"isTranslationUnit", cursor_predicate_isTranslationUnit},
-    {"isPreprocessing", cursor_predicate_isPreprocessing},
-    {"isUnexposed", cursor_predicate_isUnexposed},
+constexpr AttributeEntry attribute_table[] = {
+    {CursorAttribute::CustomId, "CustomId",
+     cursor_attribute_CustomId, AttributeValue::Id},
+    {CursorAttribute::TypeSpelling, "TypeSpelling",
+     cursor_attribute_TypeSpelling, AttributeValue::Text},
+    {CursorAttribute::TypeKindSpelling, "TypeKindSpelling",
+     cursor_attribute_TypeKindSpelling, AttributeValue::Text},
+    {CursorAttribute::CursorUSR, "CursorUSR",
+     cursor_attribute_CursorUSR, AttributeValue::Text},
+    {CursorAttribute::CursorSpelling, "CursorSpelling",
+     cursor_attribute_CursorSpelling, AttributeValue::Text},
+    {CursorAttribute::CursorDisplayName, "CursorDisplayName",
+     cursor_attribute_CursorDisplayName, AttributeValue::Text},
+    {CursorAttribute::CursorKindSpelling, "CursorKindSpelling",
+     cursor_attribute_CursorKindSpelling, AttributeValue::Text},
+    {CursorAttribute::RawCommentText, "RawCommentText",
+     cursor_attribute_RawCommentText, AttributeValue::Text},
+    {CursorAttribute::BriefCommentText, "BriefCommentText",
+     cursor_attribute_BriefCommentText, AttributeValue::Text},
+    {CursorAttribute::location, "location",
+     cursor_attribute_location, AttributeValue::Location},
+    {CursorAttribute::SemanticParent, "SemanticParent",
+     cursor_attribute_SemanticParent, AttributeValue::Id},
+    {CursorAttribute::LexicalParent, "LexicalParent",
+     cursor_attribute_LexicalParent, AttributeValue::Id},
+    {CursorAttribute::Referenced, "Referenced",
+     cursor_attribute_Referenced, AttributeValue::Id},
+    {CursorAttribute::Definition, "Definition",
+     cursor_attribute_Definition, AttributeValue::Id},
+    {CursorAttribute::CanonicalCursor, "CanonicalCursor",
+     cursor_attribute_CanonicalCursor, AttributeValue::Id},
+    {CursorAttribute::SpecializedCursorTemplate, "SpecializedCursorTemplate",
+     cursor_attribute_SpecializedCursorTemplate, AttributeValue::Id},
+    {CursorAttribute::hasAttributes, "hasAttributes",
+     cursor_predicate_hasAttributes, AttributeValue::Bool},
+    {CursorAttribute::isInSystemHeader, "isInSystemHeader",
+     cursor_predicate_isInSystemHeader, AttributeValue::Bool},
+    {CursorAttribute::isFromMainFile, "isFromMainFile",
+     cursor_predicate_isFromMainFile, AttributeValue::Bool},
+    {CursorAttribute::isDeclaration, "isDeclaration",
+     cursor_predicate_isDeclaration, AttributeValue::Bool},
+    {CursorAttribute::isReference, "isReference",
+     cursor_predicate_isReference, AttributeValue::Bool},
+    {CursorAttribute::isExpression, "isExpression",
+     cursor_predicate_isExpression, AttributeValue::Bool},
+    {CursorAttribute::isStatement, "isStatement",
+     cursor_predicate_isStatement, AttributeValue::Bool},
+    {CursorAttribute::isAttribute, "isAttribute",
+     cursor_predicate_isAttribute, AttributeValue::Bool},
+    {CursorAttribute::isInvalid, "isInvalid",
+     cursor_predicate_isInvalid, AttributeValue::Bool},
+    {CursorAttribute::isTranslationUnit, "isTranslationUnit",
+     cursor_predicate_isTranslationUnit, AttributeValue::Bool},
+    {CursorAttribute::isPreprocessing, "isPreprocessing",
+     cursor_predicate_isPreprocessing, AttributeValue::Bool},
+    {CursorAttribute::isUnexposed, "isUnexposed",
+     cursor_predicate_isUnexposed, AttributeValue::Bool},
     //
-    {"isMacroFunctionLike", cursor_predicate_isMacroFunctionLike},
-    {"isMacroBuiltin", cursor_predicate_isMacroBuiltin},
-    {"isFunctionInlined", cursor_predicate_isFunctionInlined},
-    {"isBitField", cursor_predicate_isBitField},
-    {"isDynamicCall", cursor_predicate_isDynamicCall},
-    {"isVariadic", cursor_predicate_isVariadic},
-    {"isConvertingConstructor", cursor_predicate_isConvertingConstructor},
-    {"isCopyConstructor", cursor_predicate_isCopyConstructor},
-    {"isDefaultConstructor", cursor_predicate_isDefaultConstructor},
-    {"isMoveConstructor", cursor_predicate_isMoveConstructor},
-    {"isMutable", cursor_predicate_isMutable},
-    {"isDefaulted", cursor_predicate_isDefaulted},
-    {"isCursorDefinition", cursor_predicate_isCursorDefinition},
-    {"isPureVirtual", cursor_predicate_isPureVirtual},
-    {"isStatic", cursor_predicate_isStatic},
-    {"isVirtual", cursor_predicate_isVirtual},
-    {"isVirtualBase", cursor_predicate_isVirtualBase},
-    {"isConst", cursor_predicate_isConst},
-    {"ClassType", cursor_attribute_getClassType},
-    {"NamedType", cursor_attribute_getNamedType},
-    {"isConstQualifiedType", cursor_predicate_isConstQualifiedType},
-    {"isVolatileQualifiedType", cursor_predicate_isVolatileQualifiedType},
-    {"isRestrictQualifiedType", cursor_predicate_isRestrictQualifiedType},
-    {"isFunctionTypeVariadic", cursor_predicate_isFunctionTypeVariadic},
-    {"isPODType", cursor_predicate_isPODType},
-    {"AlignOf", cursor_attribute_getAlignOf},
-    {"SizeOf", cursor_attribute_getSizeOf},
-    {"NumTemplateArguments", cursor_attribute_getNumTemplateArguments},
-    {"NumArguments", cursor_attribute_getNumArguments},
-    {"CXXRefQualifier", cursor_attribute_getCXXRefQualifier},
-    {"StorageClass", cursor_attribute_getStorageClass}};
+    {CursorAttribute::isMacroFunctionLike, "isMacroFunctionLike",
+     cursor_predicate_isMacroFunctionLike, AttributeValue::Bool},
+    {CursorAttribute::isMacroBuiltin, "isMacroBuiltin",
+     cursor_predicate_isMacroBuiltin, AttributeValue::Bool},
+    {CursorAttribute::isFunctionInlined, "isFunctionInlined",
+     cursor_predicate_isFunctionInlined, AttributeValue::Bool},
+    {CursorAttribute::isBitField, "isBitField",
+     cursor_predicate_isBitField, AttributeValue::Bool},
+    {CursorAttribute::isDynamicCall, "isDynamicCall",
+     cursor_predicate_isDynamicCall, AttributeValue::Bool},
+    {CursorAttribute::isVariadic, "isVariadic",
+     cursor_predicate_isVariadic, AttributeValue::Bool},
+    {CursorAttribute::isConvertingConstructor, "isConvertingConstructor",
+     cursor_predicate_isConvertingConstructor, AttributeValue::Bool},
+    {CursorAttribute::isCopyConstructor, "isCopyConstructor",
+     cursor_predicate_isCopyConstructor, AttributeValue::Bool},
+    {CursorAttribute::isDefaultConstructor, "isDefaultConstructor",
+     cursor_predicate_isDefaultConstructor, AttributeValue::Bool},
+    {CursorAttribute::isMoveConstructor, "isMoveConstructor",
+     cursor_predicate_isMoveConstructor, AttributeValue::Bool},
+    {CursorAttribute::isMutable, "isMutable",
+     cursor_predicate_isMutable, AttributeValue::Bool},
+    {CursorAttribute::isDefaulted, "isDefaulted",
+     cursor_predicate_isDefaulted, AttributeValue::Bool},
+    {CursorAttribute::isCursorDefinition, "isCursorDefinition",
+     cursor_predicate_isCursorDefinition, AttributeValue::Bool},
+    {CursorAttribute::isPureVirtual, "isPureVirtual",
+     cursor_predicate_isPureVirtual, AttributeValue::Bool},
+    {CursorAttribute::isStatic, "isStatic",
+     cursor_predicate_isStatic, AttributeValue::Bool},
+    {CursorAttribute::isVirtual, "isVirtual",
+     cursor_predicate_isVirtual, AttributeValue::Bool},
+    {CursorAttribute::isVirtualBase, "isVirtualBase",
+     cursor_predicate_isVirtualBase, AttributeValue::Bool},
+    {CursorAttribute::isConst, "isConst",
+     cursor_predicate_isConst, AttributeValue::Bool},
+    {CursorAttribute::ClassType, "ClassType",
+     cursor_attribute_getClassType, AttributeValue::Text},
+    {CursorAttribute::NamedType, "NamedType",
+     cursor_attribute_getNamedType, AttributeValue::Text},
+    {CursorAttribute::isConstQualifiedType, "isConstQualifiedType",
+     cursor_predicate_isConstQualifiedType, AttributeValue::Bool},
+    {CursorAttribute::isVolatileQualifiedType, "isVolatileQualifiedType",
+     cursor_predicate_isVolatileQualifiedType, AttributeValue::Bool},
+    {CursorAttribute::isRestrictQualifiedType, "isRestrictQualifiedType",
+     cursor_predicate_isRestrictQualifiedType, AttributeValue::Bool},
+    {CursorAttribute::isFunctionTypeVariadic, "isFunctionTypeVariadic",
+     cursor_predicate_isFunctionTypeVariadic, AttributeValue::Bool},
+    {CursorAttribute::isPODType, "isPODType",
+     cursor_predicate_isPODType, AttributeValue::Bool},
+    {CursorAttribute::AlignOf, "AlignOf",
+     cursor_attribute_getAlignOf, AttributeValue::Integer},
+    {CursorAttribute::SizeOf, "SizeOf",
+     cursor_attribute_getSizeOf, AttributeValue::Integer},
+    {CursorAttribute::NumTemplateArguments, "NumTemplateArguments",
+     cursor_attribute_getNumTemplateArguments, AttributeValue::Integer},
+    {CursorAttribute::NumArguments, "NumArguments",
+     cursor_attribute_getNumArguments, AttributeValue::Integer},
+    {CursorAttribute::CXXRefQualifier, "CXXRefQualifier",
+     cursor_attribute_getCXXRefQualifier, AttributeValue::RefQualifier},
+    {CursorAttribute::StorageClass, "StorageClass",
+     cursor_attribute_getStorageClass, AttributeValue::StorageClass}};
+
+constexpr bool attribute_table_in_order(std::size_t i = 0) {
+  return i == attribute_count ||
+         ((std::size_t)attribute_table[i].attribute == i &&
+          attribute_table_in_order(i + 1));
+}
+static_assert(sizeof(attribute_table) / sizeof(attribute_table[0]) ==
+                  attribute_count,
+              "attribute_table is missing an attribute");
+static_assert(attribute_table_in_order(),
+              "attribute_table is out of order with CursorAttribute");
+
+const AttributeEntry &attribute_entry(CursorAttribute attribute) {
+  return attribute_table[(std::size_t)attribute];
+}
 
 /*
- * The rest of the code is just implementing a CXCursorVisitor to visit the
- * indicated nodes and get the information you want.  This involves getting some
- * information from the arguments passed in, potentially getting the cursor
- * corresponding to a location, and building a fairly large string to dump to
- * the std::cout.
+ * Every attribute is asked for through here, so --profile can time it.
  */
-
-bool is_predicate(const std::string &attribute) {
-  return attribute.substr(0,2) == "is" || attribute.substr(0,3) == "has";
+AttributeValue attribute_value(const AttributeEntry &entry,
+                               CursorContext &context) {
+  if (!profiling_enabled) {
+    return entry.get(context);
+  }
+  std::uint64_t start = profile_clock();
+  AttributeValue value = entry.get(context);
+  profile_attribute(entry.attribute, profile_clock() - start);
+  return value;
 }
 
-bool meaningless_attribute(const std::string &value) {
-  return value == "" || value == "None" || value == "fail" ||
-         value == "null cxstring" || value == "-1";
+bool find_attribute(const std::string &name, CursorAttribute &attribute) {
+  for (auto &&entry : attribute_table) {
+    if (name == entry.name) {
+      attribute = entry.attribute;
+      return true;
+    }
+  }
+  return false;
 }
 
-bool meaningless_predicate(const std::string &attribute, const std::string &value) {
-  return is_predicate(attribute) && value == "F";
+/*
+ * The rest of the code is just implementing a CXCursorVisitor to visit the
+ * indicated nodes and get the information you want.  This involves getting some
+ * information from the arguments passed in, potentially getting the cursor
+ * corresponding to a location, and appending a record per cursor to an
+ * OutputSink, either as text or as one line of JSON.
+ */
+
+/*
+ * parse_options has already resolved the chosen attributes into table
+ * entries, so this is a straight walk with one call per attribute.
+ */
+static void append_text_field(std::string &result, const AttributeEntry &entry,
+                              const AttributeValue &value,
+                              const std::string &string_indent) {
+  std::size_t name_size = strlen(entry.name);
+  result += string_indent;
+  result += '"';
+  result += entry.name;
+  result += "\":";
+  result.append(get_offset(name_size + 1), ' ');
+  result += '"';
+  append_value(result, value);
+  result += "\",\n";
 }
 
-std::pair<bool, std::string>
-get_meaningful_attribute(const std::string &attribute, CXCursor cursor) {
-  std::string value = cursor_attribute_map[attribute](cursor);
-  // check for predicate
-  if (meaningless_attribute(value) || meaningless_predicate(attribute, value)) {
-    return {false, std::move(value)};
-  }
-  return {true, std::move(value)};
+static void append_json_field(std::string &result, const AttributeEntry &entry,
+                              const AttributeValue &value) {
+  result += ",\"";
+  result += entry.name;
+  result += "\":";
+  append_json_value(result, value);
 }
 
 void add_data_from_map(const Options &options, std::string &result,
                        CXCursor cursor, const std::string &string_indent) {
-  for (auto &&attribute : options.chosen_attributes) {
-    // cout << &attribute << endl;
-    if (cursor_attribute_map.find(attribute) == cursor_attribute_map.end()) {
-      std::cerr << "unknown attribute in the mix" << endl;
+  CursorContext context(cursor);
+  for (CursorAttribute attribute : options.resolved_attributes) {
+    const AttributeEntry &entry = attribute_entry(attribute);
+    AttributeValue value = attribute_value(entry, context);
+    if (!options.verbose && meaningless_value(value)) {
       continue;
     }
-    std::pair<bool, std::string> meaningful_value =
-        get_meaningful_attribute(attribute, cursor);
-    if (!options.verbose && !meaningful_value.first) {
+    append_text_field(result, entry, value, string_indent);
+  }
+}
+
+/*
+ * Same walk as add_data_from_map, but the fields of a JSON object, typed where
+ * JSON has a type for it.
+ */
+void add_json_from_map(const Options &options, std::string &result,
+                       CXCursor cursor) {
+  CursorContext context(cursor);
+  for (CursorAttribute attribute : options.resolved_attributes) {
+    const AttributeEntry &entry = attribute_entry(attribute);
+    AttributeValue value = attribute_value(entry, context);
+    if (!options.verbose && meaningless_value(value)) {
       continue;
     }
-    std::string middle_space =
-        std::string(get_offset(attribute.size() + 1), ' ');
-    result += string_indent + "\"" + attribute + "\":" + middle_space + "\"" +
-              cursor_attribute_map[attribute](cursor) + "\",\n";
+    append_json_field(result, entry, value);
   }
 }
 
-std::string string_attributes(CXCursor cursor,
-                              std::pair<Options, int> *options_i) {
-  size_t indent = options_i->second;
-  std::string result(indent, '_');
+const std::string hline = "----------------------------------------";
+
+/*
+ * Appends the record for one cursor, in whichever format was asked for.
+ */
+void append_record(std::string &result, CXCursor cursor,
+                   const Options &options, int indent) {
+  if (options.format == OutputFormat::NDJSON) {
+    result += "{\"depth\":";
+    result += std::to_string(indent / 2 - 1);
+    add_json_from_map(options, result, cursor);
+    result += "}\n";
+    return;
+  }
+  result.append(indent, '_');
   result += '\n';
   std::string string_indent(indent, ' ');
-  add_data_from_map(options_i->first, result, cursor, string_indent);
-  return result;
+  add_data_from_map(options, result, cursor, string_indent);
+  result += hline;
+  result += '\n';
 }
 
 using namespace std;
 
-const string hline = "----------------------------------------";
+/*
+ * The walk keeps its own stack instead of calling clang_visitChildren from
+ * inside the visitor, so deep template instantiations don't eat the native
+ * stack, and a depth limit means the cursors below it are never visited at all.
+ * libclang only hands out children through a visitor, so each cursor's
+ * children are gathered into a scratch vector and pushed in reverse, which
+ * keeps the output in the same preorder as a recursive walk.  Without -r only
+ * the cursor itself is visited.  With --where, cursors that don't match are
+ * walked through but not written, and subtrees the filter rules out as a whole
+ * (see cursor_filter.cc) are not walked at all.  Neither are declarations
+ * already written with -D.
+ */
+struct TraversalItem {
+  CXCursor cursor;
+  unsigned depth;
+};
 
-CXChildVisitResult subtree_attribute(CXCursor cursor, CXCursor,
-                                     CXClientData data) {
-  pair<Options, int> *options_i = (pair<Options, int> *)data;
-  options_i->second += 2;
-  cout << string_attributes(cursor, options_i) << hline << endl;
-  // cout << string_attributes(cursor) << hline << endl;
-  clang_visitChildren(cursor, subtree_attribute, data);
-  options_i->second -= 2;
+static CXChildVisitResult collect_child(CXCursor cursor, CXCursor,
+                                        CXClientData data) {
+  ((std::vector<CXCursor> *)data)->push_back(cursor);
   return CXChildVisit_Continue;
 }
 
+static unsigned depth_limit(const Options &options) {
+  if (!options.recurse) {
+    return 0;
+  }
+  if (options.max_depth < 0) {
+    return std::numeric_limits<unsigned>::max();
+  }
+  return (unsigned)options.max_depth;
+}
+
+template <typename Visit>
+static void walk_cursor_tree(CXCursor root, const Options &options,
+                             Visit visit) {
+  PhaseTimer timer(ProfilePhase::Traverse);
+  unsigned limit = depth_limit(options);
+  // without children to skip, pruning the root only passes over a cursor
+  // that doesn't match anyway
+  IncludeSites includes(options.filter.prunes() && limit != 0
+                            ? clang_Cursor_getTranslationUnit(root)
+                            : nullptr);
+  std::vector<TraversalItem> stack;
+  std::vector<CXCursor> children;
+  stack.push_back(TraversalItem{root, 0});
+  while (!stack.empty()) {
+    TraversalItem item = stack.back();
+    stack.pop_back();
+    bool matched = true;
+    if (!options.filter.empty() || options.dedup) {
+      CursorContext context(item.cursor);
+      if (!options.filter.empty()) {
+        if (!options.filter.may_match_below(context, includes)) {
+          continue;
+        }
+        matched = options.filter.matches(context);
+      }
+      if (options.dedup && !first_declaration(context)) {
+        continue;
+      }
+    }
+    if (matched) {
+      if (profiling_enabled) {
+        profile_cursor();
+      }
+      visit(item.cursor, item.depth);
+    }
+    if (item.depth >= limit) {
+      continue;
+    }
+    children.clear();
+    clang_visitChildren(item.cursor, collect_child, &children);
+    for (auto child = children.rbegin(); child != children.rend(); ++child) {
+      stack.push_back(TraversalItem{*child, item.depth + 1});
+    }
+  }
+}
+
+void dump_cursor_tree(CXCursor cursor, const Options &options,
+                      OutputSink &out) {
+  walk_cursor_tree(cursor, options, [&](CXCursor current, unsigned depth) {
+    append_record(out.buffer(), current, options, (int)(depth + 1) * 2);
+    out.record_done();
+  });
+}
+
+void dump_cursor_tree(CXCursor cursor, const Options &options,
+                      ColumnarDump &columns) {
+  walk_cursor_tree(cursor, options, [&](CXCursor current, unsigned depth) {
+    columns.add_record(current, depth);
+  });
+}
+
+/*
+ * The same walk, split in two for the stages of project mode (see
+ * project_mode.cc): collecting only asks libclang for the attribute values,
+ * batch_size records at a time, and formatting turns a batch into the text
+ * append_record would have written.  The values are detached as they are
+ * collected, so formatting never calls libclang and can run on another thread
+ * while the walk goes on, or after the translation unit is gone.
+ */
+void collect_cursor_records(CXCursor cursor, const Options &options,
+                            std::size_t batch_size,
+                            const std::function<void(RawRecords &)> &flush) {
+  RawRecords records;
+  walk_cursor_tree(cursor, options, [&](CXCursor current, unsigned depth) {
+    CursorContext context(current);
+    records.depths.push_back(depth);
+    for (CursorAttribute attribute : options.resolved_attributes) {
+      records.values.push_back(
+          attribute_value(attribute_entry(attribute), context));
+      records.values.back().detach();
+    }
+    if (records.depths.size() >= batch_size) {
+      flush(records);
+      records = RawRecords();
+    }
+  });
+  if (!records.depths.empty()) {
+    flush(records);
+  }
+}
+
+void append_raw_records(std::string &result, const RawRecords &records,
+                        const Options &options) {
+  PhaseTimer timer(ProfilePhase::Format);
+  const AttributeValue *value = records.values.data();
+  std::string string_indent;
+  for (unsigned depth : records.depths) {
+    int indent = (int)(depth + 1) * 2;
+    if (options.format == OutputFormat::NDJSON) {
+      result += "{\"depth\":";
+      result += std::to_string(depth);
+    } else {
+      result.append(indent, '_');
+      result += '\n';
+      string_indent.assign(indent, ' ');
+    }
+    for (CursorAttribute attribute : options.resolved_attributes) {
+      const AttributeEntry &entry = attribute_entry(attribute);
+      if (options.verbose || !meaningless_value(*value)) {
+        if (options.format == OutputFormat::NDJSON) {
+          append_json_field(result, entry, *value);
+        } else {
+          append_text_field(result, entry, *value, string_indent);
+        }
+      }
+      ++value;
+    }
+    if (options.format == OutputFormat::NDJSON) {
+      result += "}\n";
+    } else {
+      result += hline;
+      result += '\n';
+    }
+  }
+}
+
 int main(int argc, char *argv[]) {
 
   std::list<std::string> attribute_list;
-  for (auto &&attribute : cursor_attribute_map) {
-    attribute_list.push_back(attribute.first);
+  for (auto &&entry : attribute_table) {
+    attribute_list.push_back(entry.name);
   }
 
   Options options;
@@ -648,29 +1127,110 @@ int main(int argc, char *argv[]) {
     // cout << Options::help(argv[0]) << endl;
     return 1;
   }
-  cout << options.dump() << "\n\n" << endl;
+  // before the output, so the final flush is timed too
+  ProfileReport profile_report(options.profile);
+  MemoryReport memory_report(options.mem_stats);
+  if (!options.query_index.empty()) {
+    OutputSink out(STDOUT_FILENO);
+    return run_symbol_query(options.query_index, options.query_usrs, out);
+  }
+  // the session protocol is spoken on stdout, so keep it clean
+  if (options.session) {
+    return run_session(options, cin, cout);
+  }
+  use_usr_ids(options.usr_ids);
+  OutputSink out(STDOUT_FILENO);
+  if (!options.output.empty() && !out.open(options.output)) {
+    cerr << "could not open " << options.output << endl;
+    return 1;
+  }
+  if (!options.merge_inputs.empty()) {
+    return run_merge(options, out);
+  }
+  // only the plain text dump has room for commentary
+  ostream &info = options.format == OutputFormat::Text ? cout : cerr;
+  info << options.dump() << "\n\n" << endl;
+
+  std::vector<CompileJob> jobs;
+  if (!options.project.empty() && !load_compile_jobs(options.project, jobs)) {
+    cerr << "could not load compile_commands.json from " << options.project
+         << endl;
+    return 1;
+  }
+  if (options.shard_count != 0) {
+    select_shard(options, jobs);
+  }
+  if (!options.socket_path.empty()) {
+    return run_daemon(options, jobs);
+  }
+  if (!options.project.empty()) {
+    return run_project(options, jobs, out);
+  }
+  if (options.backend != Backend::Visit && options.line == 0 &&
+      options.query_file.empty()) {
+    return run_index_backend(options, out);
+  }
 
+  // opened before parsing, so there is nothing to clean up if it can't be
+  OutputSink index_out;
+  if (!options.index_output.empty() && !index_out.open(options.index_output)) {
+    cerr << "could not open " << options.index_output << endl;
+    return 1;
+  }
   CXIndex index = clang_createIndex(0, 0);
-  CXTranslationUnit TU = clang_createTranslationUnitFromSourceFile(
-      index, options.source.c_str(), 0, nullptr, 0, nullptr);
+  std::vector<const char *> args{options.source.c_str()};
+  CXTranslationUnit TU =
+      parse_translation_unit(index, options.source, "", args, options);
+  if (TU == nullptr) {
+    cerr << "failed to parse " << options.source << endl;
+    clang_disposeIndex(index);
+    return 1;
+  }
+  TUMemory memory;
+  if (memory_stats_enabled) {
+    memory.file = options.source;
+    measure_parse(memory, TU);
+  }
+  size_t output_start = out.bytes_written();
+  if (!options.query_file.empty()) {
+    int result = run_location_queries(options, TU, out);
+    dispose_translation_unit(TU);
+    clang_disposeIndex(index);
+    return result;
+  }
   CXCursor cursor;
 
   if (options.line == 0) {
-    cout << "getting whole thing" << endl;
+    info << "getting whole thing" << endl;
     cursor = clang_getTranslationUnitCursor(TU);
   } else {
     CXFile cxfile = clang_getFile(TU, options.source.c_str());
     CXSourceLocation location =
         clang_getLocation(TU, cxfile, options.line, options.col);
-    cout << "cxlocation: " << string_location(location) << endl;
+    info << "cxlocation: " << string_location(location) << endl;
     cursor = clang_getCursor(TU, location);
   }
 
-  int i = 2;
-  pair<Options, int> data{options, i};
-  cout << string_attributes(cursor, &data) << hline << endl;
-  clang_visitChildren(cursor, subtree_attribute, &data);
+  if (!options.index_output.empty()) {
+    SymbolIndexBuilder symbols;
+    symbols.add_translation_unit(TU, "");
+    symbols.write(index_out);
+    info << "indexed " << symbols.size() << " symbols" << endl;
+  } else if (options.format == OutputFormat::Binary) {
+    ColumnarDump columns(options.resolved_attributes);
+    columns.begin_translation_unit(options.source);
+    dump_cursor_tree(cursor, options, columns);
+    columns.write(out);
+  } else {
+    dump_cursor_tree(cursor, options, out);
+  }
+  if (memory_stats_enabled) {
+    measure_traversal(memory);
+    memory.output_bytes = out.bytes_written() - output_start;
+    report_memory(memory);
+  }
+  out.flush();
 
-  clang_disposeTranslationUnit(TU);
+  dispose_translation_unit(TU);
   clang_disposeIndex(index);
 }
@@ -3,8 +3,14 @@
 
 #include "clang-c/Index.h"
 
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
+
+struct Options;
+class OutputSink;
+class ColumnarDump;
 
 /*
  * See cxcursor_info.cc for more detailed commentary
@@ -18,76 +24,265 @@ std::string string_ClangVersion(void);
 std::string string_FileName(CXFile SFile);
 std::string string_location(CXSourceLocation location);
 
-std::string cursor_attribute_CustomId(CXCursor cursor);
-std::string cursor_attribute_TypeSpelling(CXCursor cursor);
-std::string cursor_attribute_TypeKindSpelling(CXCursor cursor);
-std::string cursor_attribute_CursorUSR(CXCursor cursor);
-std::string cursor_attribute_CursorSpelling(CXCursor cursor);
-std::string cursor_attribute_CursorDisplayName(CXCursor cursor);
-std::string cursor_attribute_CursorKindSpelling(CXCursor cursor);
-std::string cursor_attribute_RawCommentText(CXCursor cursor);
-std::string cursor_attribute_BriefCommentText(CXCursor cursor);
-std::string cursor_attribute_Mangling(CXCursor cursor);
-std::string cursor_attribute_location(CXCursor cursor);
-std::string cursor_attribute_SemanticParent(CXCursor cursor);
-std::string cursor_attribute_LexicalParent(CXCursor cursor);
-std::string cursor_attribute_Referenced(CXCursor cursor);
-std::string cursor_attribute_Definition(CXCursor cursor);
-std::string cursor_attribute_CanonicalCursor(CXCursor cursor);
-std::string cursor_attribute_SpecializedCursorTemplate(CXCursor cursor);
-
-std::string cursor_predicate_hasAttributes(CXCursor cursor);
-std::string cursor_predicate_isInSystemHeader(CXCursor cursor);
-std::string cursor_predicate_isFromMainFile(CXCursor cursor);
-
-std::string cursor_predicate_isDeclaration(CXCursor cursor);
-std::string cursor_predicate_isReference(CXCursor cursor);
-std::string cursor_predicate_isExpression(CXCursor cursor);
-std::string cursor_predicate_isStatement(CXCursor cursor);
-std::string cursor_predicate_isAttribute(CXCursor cursor);
-std::string cursor_predicate_isInvalid(CXCursor cursor);
-std::string cursor_predicate_isTranslationUnit(CXCursor cursor);
-std::string cursor_predicate_isPreprocessing(CXCursor cursor);
-std::string cursor_predicate_isUnexposed(CXCursor cursor);
-
-std::string cursor_predicate_isMacroFunctionLike(CXCursor cursor);
-std::string cursor_predicate_isMacroBuiltin(CXCursor cursor);
-std::string cursor_predicate_isFunctionInlined(CXCursor cursor);
-std::string cursor_predicate_isBitField(CXCursor cursor);
-std::string cursor_predicate_isDynamicCall(CXCursor cursor);
-std::string cursor_predicate_isVariadic(CXCursor cursor);
-std::string cursor_predicate_isConvertingConstructor(CXCursor cursor);
-std::string cursor_predicate_isCopyConstructor(CXCursor cursor);
-std::string cursor_predicate_isDefaultConstructor(CXCursor cursor);
-std::string cursor_predicate_isMoveConstructor(CXCursor cursor);
-std::string cursor_predicate_isMutable(CXCursor cursor);
-std::string cursor_predicate_isDefaulted(CXCursor cursor);
-std::string cursor_predicate_isCursorDefinition(CXCursor cursor);
-std::string cursor_predicate_isPureVirtual(CXCursor cursor);
-std::string cursor_predicate_isStatic(CXCursor cursor);
-std::string cursor_predicate_isVirtual(CXCursor cursor);
-std::string cursor_predicate_isVirtualBase(CXCursor cursor);
-std::string cursor_predicate_isConst(CXCursor cursor);
-
-std::string cursor_attribute_getClassType(CXCursor cursor);
-std::string cursor_attribute_getNamedType(CXCursor cursor);
-
-std::string cursor_predicate_isConstQualifiedType(CXCursor cursor);
-std::string cursor_predicate_isVolatileQualifiedType(CXCursor cursor);
-std::string cursor_predicate_isRestrictQualifiedType(CXCursor cursor);
-std::string cursor_predicate_isFunctionTypeVariadic(CXCursor cursor);
-std::string cursor_predicate_isPODType(CXCursor cursor);
-
-std::string cursor_attribute_getAlignOf(CXCursor cursor);
-std::string cursor_attribute_getSizeOf(CXCursor cursor);
-
-std::string cursor_attribute_getNumTemplateArguments(CXCursor cursor);
-
-std::string cursor_attribute_getNumArguments(CXCursor cursor);
-std::string cursor_attribute_getNumTemplateArguments(CXCursor cursor);
-
-std::string cursor_attribute_getCXXRefQualifier(CXCursor cursor);
-std::string cursor_attribute_getStorageClass(CXCursor cursor);
-
-
-std::string string_attributes(CXCursor cursor, int indent = 0);
+struct SpellingLocation {
+  CXFile file;
+  unsigned line;
+  unsigned col;
+};
+
+/*
+ * The libclang queries shared by several attributes, made at most once per
+ * cursor and only if some chosen attribute needs them.
+ */
+struct CursorContext {
+  CXCursor cursor;
+  CXCursorKind kind;
+
+  explicit CursorContext(CXCursor c);
+  CXType type();
+  CXSourceLocation location();
+  const SpellingLocation &spelling_location();
+
+private:
+  bool have_type;
+  bool have_location;
+  bool have_spelling_location;
+  CXType cursor_type;
+  CXSourceLocation cursor_location;
+  SpellingLocation spelling;
+};
+
+/*
+ * The value of an attribute, kept in its native form until it is written out
+ * by append_value.  Text values own their CXString, so this is move only.
+ * detach copies what still refers to the translation unit (the text, or the
+ * file name of a location) into copied, so the value can be written out on
+ * another thread, even after the translation unit is gone.
+ */
+struct AttributeValue {
+  enum Kind : unsigned char {
+    Null,
+    Bool,
+    Integer,
+    Id,
+    Text,
+    Location,
+    RefQualifier,
+    StorageClass
+  };
+  Kind kind;
+  long long number;
+  CXString cxstring;
+  CXFile file;
+  unsigned line;
+  unsigned col;
+  bool detached;
+  std::string copied;
+
+  AttributeValue();
+  AttributeValue(AttributeValue &&other);
+  AttributeValue &operator=(AttributeValue &&other);
+  AttributeValue(const AttributeValue &) = delete;
+  AttributeValue &operator=(const AttributeValue &) = delete;
+  ~AttributeValue();
+  void detach();
+
+  static AttributeValue null();
+  static AttributeValue boolean(bool value);
+  static AttributeValue integer(long long value);
+  static AttributeValue id(std::uint32_t value);
+  static AttributeValue text(CXString value);
+  static AttributeValue copied_text(const std::string &value);
+  static AttributeValue location(CXFile file, unsigned line, unsigned col);
+  static AttributeValue ref_qualifier(CXRefQualifierKind value);
+  static AttributeValue storage_class(CX_StorageClass value);
+};
+
+const char *string_RefQualifier(long long ref_qualifier);
+const char *string_StorageClass(long long storage_class);
+const char *value_text(const AttributeValue &value);
+bool meaningless_value(const AttributeValue &value);
+void append_value(std::string &result, const AttributeValue &value);
+void append_json_value(std::string &result, const AttributeValue &value);
+
+void use_usr_ids(bool use);
+void reset_id_table(void);
+void release_id_table(void);
+std::size_t id_table_size(void);
+std::size_t id_table_memory(void);
+std::uint32_t cursor_id(CXCursor cursor);
+
+AttributeValue cursor_attribute_CustomId(CursorContext &context);
+AttributeValue cursor_attribute_TypeSpelling(CursorContext &context);
+AttributeValue cursor_attribute_TypeKindSpelling(CursorContext &context);
+AttributeValue cursor_attribute_CursorUSR(CursorContext &context);
+AttributeValue cursor_attribute_CursorSpelling(CursorContext &context);
+AttributeValue cursor_attribute_CursorDisplayName(CursorContext &context);
+AttributeValue cursor_attribute_CursorKindSpelling(CursorContext &context);
+AttributeValue cursor_attribute_RawCommentText(CursorContext &context);
+AttributeValue cursor_attribute_BriefCommentText(CursorContext &context);
+AttributeValue cursor_attribute_Mangling(CursorContext &context);
+AttributeValue cursor_attribute_location(CursorContext &context);
+AttributeValue cursor_attribute_SemanticParent(CursorContext &context);
+AttributeValue cursor_attribute_LexicalParent(CursorContext &context);
+AttributeValue cursor_attribute_Referenced(CursorContext &context);
+AttributeValue cursor_attribute_Definition(CursorContext &context);
+AttributeValue cursor_attribute_CanonicalCursor(CursorContext &context);
+AttributeValue
+cursor_attribute_SpecializedCursorTemplate(CursorContext &context);
+
+AttributeValue cursor_predicate_hasAttributes(CursorContext &context);
+AttributeValue cursor_predicate_isInSystemHeader(CursorContext &context);
+AttributeValue cursor_predicate_isFromMainFile(CursorContext &context);
+
+AttributeValue cursor_predicate_isDeclaration(CursorContext &context);
+AttributeValue cursor_predicate_isReference(CursorContext &context);
+AttributeValue cursor_predicate_isExpression(CursorContext &context);
+AttributeValue cursor_predicate_isStatement(CursorContext &context);
+AttributeValue cursor_predicate_isAttribute(CursorContext &context);
+AttributeValue cursor_predicate_isInvalid(CursorContext &context);
+AttributeValue cursor_predicate_isTranslationUnit(CursorContext &context);
+AttributeValue cursor_predicate_isPreprocessing(CursorContext &context);
+AttributeValue cursor_predicate_isUnexposed(CursorContext &context);
+
+AttributeValue cursor_predicate_isMacroFunctionLike(CursorContext &context);
+AttributeValue cursor_predicate_isMacroBuiltin(CursorContext &context);
+AttributeValue cursor_predicate_isFunctionInlined(CursorContext &context);
+AttributeValue cursor_predicate_isBitField(CursorContext &context);
+AttributeValue cursor_predicate_isDynamicCall(CursorContext &context);
+AttributeValue cursor_predicate_isVariadic(CursorContext &context);
+AttributeValue cursor_predicate_isConvertingConstructor(CursorContext &context);
+AttributeValue cursor_predicate_isCopyConstructor(CursorContext &context);
+AttributeValue cursor_predicate_isDefaultConstructor(CursorContext &context);
+AttributeValue cursor_predicate_isMoveConstructor(CursorContext &context);
+AttributeValue cursor_predicate_isMutable(CursorContext &context);
+AttributeValue cursor_predicate_isDefaulted(CursorContext &context);
+AttributeValue cursor_predicate_isCursorDefinition(CursorContext &context);
+AttributeValue cursor_predicate_isPureVirtual(CursorContext &context);
+AttributeValue cursor_predicate_isStatic(CursorContext &context);
+AttributeValue cursor_predicate_isVirtual(CursorContext &context);
+AttributeValue cursor_predicate_isVirtualBase(CursorContext &context);
+AttributeValue cursor_predicate_isConst(CursorContext &context);
+
+AttributeValue cursor_attribute_getClassType(CursorContext &context);
+AttributeValue cursor_attribute_getNamedType(CursorContext &context);
+
+AttributeValue cursor_predicate_isConstQualifiedType(CursorContext &context);
+AttributeValue cursor_predicate_isVolatileQualifiedType(CursorContext &context);
+AttributeValue cursor_predicate_isRestrictQualifiedType(CursorContext &context);
+AttributeValue cursor_predicate_isFunctionTypeVariadic(CursorContext &context);
+AttributeValue cursor_predicate_isPODType(CursorContext &context);
+
+AttributeValue cursor_attribute_getAlignOf(CursorContext &context);
+AttributeValue cursor_attribute_getSizeOf(CursorContext &context);
+
+AttributeValue cursor_attribute_getNumTemplateArguments(CursorContext &context);
+
+AttributeValue cursor_attribute_getNumArguments(CursorContext &context);
+AttributeValue cursor_attribute_getNumTemplateArguments(CursorContext &context);
+
+AttributeValue cursor_attribute_getCXXRefQualifier(CursorContext &context);
+AttributeValue cursor_attribute_getStorageClass(CursorContext &context);
+
+/*
+ * Every attribute and predicate that can be asked for, in the order of
+ * attribute_table in cxcursor_info.cc.
+ */
+enum class CursorAttribute : unsigned char {
+  CustomId,
+  TypeSpelling,
+  TypeKindSpelling,
+  CursorUSR,
+  CursorSpelling,
+  CursorDisplayName,
+  CursorKindSpelling,
+  RawCommentText,
+  BriefCommentText,
+  location,
+  SemanticParent,
+  LexicalParent,
+  Referenced,
+  Definition,
+  CanonicalCursor,
+  SpecializedCursorTemplate,
+  hasAttributes,
+  isInSystemHeader,
+  isFromMainFile,
+  isDeclaration,
+  isReference,
+  isExpression,
+  isStatement,
+  isAttribute,
+  isInvalid,
+  isTranslationUnit,
+  isPreprocessing,
+  isUnexposed,
+  isMacroFunctionLike,
+  isMacroBuiltin,
+  isFunctionInlined,
+  isBitField,
+  isDynamicCall,
+  isVariadic,
+  isConvertingConstructor,
+  isCopyConstructor,
+  isDefaultConstructor,
+  isMoveConstructor,
+  isMutable,
+  isDefaulted,
+  isCursorDefinition,
+  isPureVirtual,
+  isStatic,
+  isVirtual,
+  isVirtualBase,
+  isConst,
+  ClassType,
+  NamedType,
+  isConstQualifiedType,
+  isVolatileQualifiedType,
+  isRestrictQualifiedType,
+  isFunctionTypeVariadic,
+  isPODType,
+  AlignOf,
+  SizeOf,
+  NumTemplateArguments,
+  NumArguments,
+  CXXRefQualifier,
+  StorageClass
+};
+constexpr std::size_t attribute_count =
+    (std::size_t)CursorAttribute::StorageClass + 1;
+
+struct AttributeEntry {
+  CursorAttribute attribute;
+  const char *name;
+  AttributeValue (*get)(CursorContext &);
+  AttributeValue::Kind kind;
+};
+
+const AttributeEntry &attribute_entry(CursorAttribute attribute);
+AttributeValue attribute_value(const AttributeEntry &entry,
+                               CursorContext &context);
+bool find_attribute(const std::string &name, CursorAttribute &attribute);
+
+void append_record(std::string &result, CXCursor cursor,
+                   const Options &options, int indent);
+void dump_cursor_tree(CXCursor cursor, const Options &options,
+                      OutputSink &out);
+void dump_cursor_tree(CXCursor cursor, const Options &options,
+                      ColumnarDump &columns);
+
+/*
+ * Records collected by one stage of project mode and formatted by the next:
+ * the depth of each cursor, and the values of its attributes (detached) in
+ * the order of options.resolved_attributes.
+ */
+struct RawRecords {
+  std::vector<unsigned> depths;
+  std::vector<AttributeValue> values;
+};
+
+void collect_cursor_records(CXCursor cursor, const Options &options,
+                            std::size_t batch_size,
+                            const std::function<void(RawRecords &)> &flush);
+void append_raw_records(std::string &result, const RawRecords &records,
+                        const Options &options);
@@ -0,0 +1,67 @@
+// declaration_set.cc
+
+#include "declaration_set.h"
+
+#include <functional>
+
+/* -D/--dedup writes every declaration once per run, rather than once for each
+ * translation unit that includes the header it is in.  A declaration is known
+ * by its USR and its spelling location, so redeclarations in other places are
+ * still written, and only the copies coming from a shared header are dropped.
+ * When a declaration has been written before, so has everything under it, and
+ * the walk skips the whole subtree: a second translation unit including
+ * <vector> hardly visits the header at all.  Headers that come out differently
+ * depending on macros set by the includer are the exception, only the first
+ * version is written.
+ *
+ * All project workers share the one set, so which translation unit a shared
+ * declaration is written under depends on how the jobs were scheduled; with
+ * -j 1 it is always the first one in the database.  The set is split into
+ * shards, each behind its own lock, so the workers rarely wait on each other.
+ * */
+
+using namespace std;
+
+bool DeclarationSet::insert(const string &key) {
+  Shard &shard = shards[hash<string>()(key) % shard_count];
+  lock_guard<mutex> guard(shard.lock);
+  return shard.keys.insert(key).second;
+}
+
+size_t DeclarationSet::size() {
+  size_t total = 0;
+  for (auto &&shard : shards) {
+    lock_guard<mutex> guard(shard.lock);
+    total += shard.keys.size();
+  }
+  return total;
+}
+
+static DeclarationSet seen_declarations;
+
+/*
+ * Cursors that aren't declarations, or have no USR, are never duplicates.
+ */
+bool first_declaration(CursorContext &context) {
+  if (!clang_isDeclaration(context.kind)) {
+    return true;
+  }
+  CXString cxusr = clang_getCursorUSR(context.cursor);
+  const char *usr = clang_getCString(cxusr);
+  if (usr == nullptr || *usr == '\0') {
+    clang_disposeString(cxusr);
+    return true;
+  }
+  string key = usr;
+  clang_disposeString(cxusr);
+  const SpellingLocation &location = context.spelling_location();
+  key += '@';
+  key += string_FileName(location.file);
+  key += ':';
+  key += to_string(location.line);
+  key += ':';
+  key += to_string(location.col);
+  return seen_declarations.insert(key);
+}
+
+size_t declaration_set_size(void) { return seen_declarations.size(); }
@@ -0,0 +1,31 @@
+//declaration_set.h
+#pragma once
+
+#include "cxcursor_info.h"
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+/*
+ * See declaration_set.cc for more detailed commentary
+ */
+
+class DeclarationSet {
+public:
+  bool insert(const std::string &key);
+  std::size_t size();
+
+  static const std::size_t shard_count = 64;
+
+private:
+  struct alignas(64) Shard {
+    std::mutex lock;
+    std::unordered_set<std::string> keys;
+  };
+  Shard shards[shard_count];
+};
+
+bool first_declaration(CursorContext &context);
+std::size_t declaration_set_size(void);
@@ -0,0 +1,146 @@
+// index_backend.cc
+
+#include "index_backend.h"
+#include "columnar_dump.h"
+#include "cursor_filter.h"
+#include "cxcursor_info.h"
+#include "declaration_set.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+#include "profiler.h"
+#include "symbol_index.h"
+#include "tu_cache.h"
+
+#include <iostream>
+
+/* -B index and -B session replace the cursor walk with libclang's indexer
+ * (clang_indexSourceFile).  Instead of every statement and expression in the
+ * AST, the indexer only calls back for declarations and for references to
+ * declared entities, which is all a symbol index or an API dump needs.  Each
+ * of them is written as the same record the walk writes, with depth 0, since
+ * the indexer reports a flat stream rather than a tree.  --where and -D apply
+ * as usual, but -L, -r and --max-depth have no meaning here.
+ *
+ * With -B session every translation unit a project worker indexes shares one
+ * CXIndexAction, and CXIndexOpt_SkipParsedBodiesInSession lets libclang skip
+ * the bodies of inline functions in headers it has already indexed in that
+ * session.  That saves a lot on header heavy projects, but which translation
+ * unit reports a header's bodies then depends on how the jobs were scheduled.
+ * -B index uses a fresh session for every translation unit and keeps the
+ * output stable.  The indexer parses the source itself, so -c is not used.
+ * */
+
+using namespace std;
+
+namespace {
+
+struct IndexClient {
+  const Options &options;
+  const IndexTarget &target;
+};
+
+void add_indexed_cursor(IndexClient *client, CXCursor cursor) {
+  const Options &options = client->options;
+  if (!options.filter.empty() || options.dedup) {
+    CursorContext context(cursor);
+    if (!options.filter.empty() && !options.filter.matches(context)) {
+      return;
+    }
+    if (options.dedup && !first_declaration(context)) {
+      return;
+    }
+  }
+  if (profiling_enabled) {
+    profile_cursor();
+  }
+  const IndexTarget &target = client->target;
+  if (target.symbols != nullptr) {
+    target.symbols->add_cursor(cursor);
+  } else if (target.columns != nullptr) {
+    target.columns->add_record(cursor, 0);
+  } else {
+    append_record(target.out->buffer(), cursor, options, 2);
+    target.out->record_done();
+  }
+}
+
+void index_declaration(CXClientData data, const CXIdxDeclInfo *info) {
+  add_indexed_cursor((IndexClient *)data, info->cursor);
+}
+
+void index_reference(CXClientData data, const CXIdxEntityRefInfo *info) {
+  add_indexed_cursor((IndexClient *)data, info->cursor);
+}
+
+} // namespace
+
+/*
+ * The source is expected among the arguments, as for parse_translation_unit.
+ * If TU is given, the translation unit is kept there for the caller to
+ * dispose of.
+ */
+bool index_source(CXIndexAction action, const string &source,
+                  const vector<const char *> &args, const Options &options,
+                  const IndexTarget &target, CXTranslationUnit *TU) {
+  unsigned index_options = CXIndexOpt_None;
+  if (options.backend == Backend::IndexSession) {
+    index_options |= CXIndexOpt_SkipParsedBodiesInSession;
+  }
+  IndexerCallbacks callbacks = {};
+  callbacks.indexDeclaration = index_declaration;
+  callbacks.indexEntityReference = index_reference;
+  IndexClient client{options, target};
+  reset_id_table();
+  // the indexer parses and reports as it goes, so it all counts as parsing
+  PhaseTimer timer(ProfilePhase::Parse);
+  int error = clang_indexSourceFile(
+      action, &client, &callbacks, sizeof(callbacks), index_options, nullptr,
+      args.data(), (int)args.size(), nullptr, 0, TU, parse_flags(options));
+  if (error != 0) {
+    cerr << "indexing " << source << " failed with libclang error " << error
+         << endl;
+    return false;
+  }
+  return true;
+}
+
+int run_index_backend(const Options &options, OutputSink &out) {
+  CXIndex index = clang_createIndex(0, 0);
+  CXIndexAction action = clang_IndexAction_create(index);
+  vector<const char *> args{options.source.c_str()};
+  IndexTarget target{nullptr, nullptr, nullptr};
+  int result = 0;
+  if (!options.index_output.empty()) {
+    SymbolIndexBuilder symbols;
+    symbols.begin_translation_unit("");
+    target.symbols = &symbols;
+    OutputSink index_out;
+    if (!index_source(action, options.source, args, options, target)) {
+      result = 1;
+    } else if (!index_out.open(options.index_output)) {
+      cerr << "could not open " << options.index_output << endl;
+      result = 1;
+    } else {
+      symbols.write(index_out);
+      cerr << "indexed " << symbols.size() << " symbols" << endl;
+    }
+  } else if (options.format == OutputFormat::Binary) {
+    ColumnarDump columns(options.resolved_attributes);
+    columns.begin_translation_unit(options.source);
+    target.columns = &columns;
+    if (index_source(action, options.source, args, options, target)) {
+      columns.write(out);
+    } else {
+      result = 1;
+    }
+  } else {
+    target.out = &out;
+    if (!index_source(action, options.source, args, options, target)) {
+      result = 1;
+    }
+  }
+  out.flush();
+  clang_IndexAction_dispose(action);
+  clang_disposeIndex(index);
+  return result;
+}
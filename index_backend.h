@@ -0,0 +1,32 @@
+//index_backend.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <string>
+#include <vector>
+
+struct Options;
+class OutputSink;
+class ColumnarDump;
+class SymbolIndexBuilder;
+
+/*
+ * See index_backend.cc for more detailed commentary
+ */
+
+/*
+ * Where the records go, exactly one of these is set.  The caller begins the
+ * translation unit of columns or symbols.
+ */
+struct IndexTarget {
+  OutputSink *out;
+  ColumnarDump *columns;
+  SymbolIndexBuilder *symbols;
+};
+
+bool index_source(CXIndexAction action, const std::string &source,
+                  const std::vector<const char *> &args,
+                  const Options &options, const IndexTarget &target,
+                  CXTranslationUnit *TU = nullptr);
+int run_index_backend(const Options &options, OutputSink &out);
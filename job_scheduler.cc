@@ -0,0 +1,179 @@
+// job_scheduler.cc
+
+#include "job_scheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+/* Translation units take anything from a few milliseconds to most of a minute
+ * to parse, so handing them out in database order tends to leave the biggest
+ * one until the end, with every other core idle while it finishes.  Project
+ * mode instead starts the longest ones first.
+ *
+ * How long a translation unit takes comes from the history file (-H file),
+ * which keeps the parse and traversal times of the last run, one line each:
+ *
+ *   <parse seconds> <traversal seconds> <file>
+ *
+ * A translation unit that isn't in the history yet is guessed from the size of
+ * its source, at the average seconds per byte of those that are (or just by
+ * size, if none are).
+ *
+ * The jobs are dealt out longest first to per worker deques, each to the
+ * worker with the least work so far.  A worker takes the jobs of its own deque
+ * from the front, and once it runs dry it steals from the worker with the most
+ * work left.  It steals that worker's longest job rather than its shortest, as
+ * would be usual, since what matters here is starting the long ones early, and
+ * with a mutex per deque either end costs the same.  None of this changes the
+ * output, which is still printed in database order.
+ * */
+
+using namespace std;
+
+JobHistory::JobHistory(const string &p) : path(p) {}
+
+bool JobHistory::load() {
+  ifstream in(path);
+  if (!in) {
+    // the first run
+    return true;
+  }
+  string line;
+  while (getline(in, line)) {
+    istringstream fields(line);
+    JobTimes job_times;
+    string file;
+    fields >> job_times.parse >> job_times.traverse;
+    fields.ignore(1);
+    getline(fields, file);
+    if (!fields && !fields.eof()) {
+      return false;
+    }
+    times[file] = job_times;
+  }
+  return true;
+}
+
+void JobHistory::record(const string &filename, const JobTimes &job_times) {
+  times[filename] = job_times;
+}
+
+static double source_size(const CompileJob &job) {
+  struct stat info;
+  if (stat(job.filename.c_str(), &info) != 0 || info.st_size <= 0) {
+    return 1;
+  }
+  return (double)info.st_size;
+}
+
+vector<double> JobHistory::estimate(const vector<CompileJob> &jobs) const {
+  vector<double> costs(jobs.size(), -1);
+  vector<double> sizes(jobs.size());
+  double known_seconds = 0;
+  double known_size = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    sizes[i] = source_size(jobs[i]);
+    auto it = times.find(jobs[i].filename);
+    if (it != times.end()) {
+      costs[i] = it->second.parse + it->second.traverse;
+      known_seconds += costs[i];
+      known_size += sizes[i];
+    }
+  }
+  double seconds_per_byte = known_seconds > 0 ? known_seconds / known_size : 1;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (costs[i] < 0) {
+      costs[i] = sizes[i] * seconds_per_byte;
+    }
+  }
+  return costs;
+}
+
+bool JobHistory::save() const {
+  string temporary = path + ".tmp";
+  {
+    ofstream out(temporary);
+    for (auto &&entry : times) {
+      out << entry.second.parse << ' ' << entry.second.traverse << ' '
+          << entry.first << '\n';
+    }
+    if (!out) {
+      remove(temporary.c_str());
+      return false;
+    }
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+vector<double> estimate_job_costs(const string &history_path,
+                                  const vector<CompileJob> &jobs) {
+  JobHistory history(history_path);
+  if (!history_path.empty()) {
+    history.load();
+  }
+  return history.estimate(jobs);
+}
+
+JobScheduler::JobScheduler(const vector<double> &costs, size_t workers)
+    : job_costs(costs), queues(new WorkerQueue[workers]),
+      queue_count(workers) {
+  vector<size_t> order(costs.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  // stable, so equal guesses keep database order
+  stable_sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+  for (size_t job : order) {
+    size_t lightest = 0;
+    for (size_t worker = 1; worker < queue_count; ++worker) {
+      if (queues[worker].remaining < queues[lightest].remaining) {
+        lightest = worker;
+      }
+    }
+    queues[lightest].jobs.push_back(job);
+    queues[lightest].remaining += costs[job];
+  }
+}
+
+bool JobScheduler::take(WorkerQueue &queue, size_t &job) {
+  lock_guard<mutex> guard(queue.lock);
+  if (queue.jobs.empty()) {
+    return false;
+  }
+  job = queue.jobs.front();
+  queue.jobs.pop_front();
+  queue.remaining -= job_costs[job];
+  return true;
+}
+
+/*
+ * Nothing is ever added once the workers are running, so a worker is done
+ * when every deque it looks at is empty.
+ */
+bool JobScheduler::next(size_t worker, size_t &job) {
+  if (take(queues[worker], job)) {
+    return true;
+  }
+  for (;;) {
+    size_t victim = queue_count;
+    double most = -1;
+    for (size_t i = 0; i < queue_count; ++i) {
+      lock_guard<mutex> guard(queues[i].lock);
+      if (!queues[i].jobs.empty() && queues[i].remaining > most) {
+        most = queues[i].remaining;
+        victim = i;
+      }
+    }
+    if (victim == queue_count) {
+      return false;
+    }
+    if (take(queues[victim], job)) {
+      return true;
+    }
+  }
+}
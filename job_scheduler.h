@@ -0,0 +1,55 @@
+//job_scheduler.h
+#pragma once
+
+#include "project_mode.h"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * See job_scheduler.cc for more detailed commentary
+ */
+
+struct JobTimes {
+  double parse;
+  double traverse;
+};
+
+class JobHistory {
+public:
+  explicit JobHistory(const std::string &path);
+  bool load();
+  void record(const std::string &filename, const JobTimes &times);
+  std::vector<double> estimate(const std::vector<CompileJob> &jobs) const;
+  bool save() const;
+
+private:
+  std::string path;
+  std::unordered_map<std::string, JobTimes> times;
+};
+
+class JobScheduler {
+public:
+  JobScheduler(const std::vector<double> &costs, std::size_t workers);
+  bool next(std::size_t worker, std::size_t &job);
+
+private:
+  struct WorkerQueue {
+    std::mutex lock;
+    std::deque<std::size_t> jobs;
+    double remaining = 0;
+  };
+  std::vector<double> job_costs;
+  std::unique_ptr<WorkerQueue[]> queues;
+  std::size_t queue_count;
+
+  bool take(WorkerQueue &queue, std::size_t &job);
+};
+
+std::vector<double> estimate_job_costs(const std::string &history_path,
+                                       const std::vector<CompileJob> &jobs);
@@ -0,0 +1,155 @@
+// location_queries.cc
+
+#include "location_queries.h"
+#include "columnar_dump.h"
+#include "cxcursor_info.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+/* -q file answers a whole list of locations against one parse of -f source,
+ * where -L answers one per run.  The file (- for stdin) has one query per line,
+ * "[file] line col", with the source assumed when the file is left out; other
+ * files have to be headers the source includes.  Blank lines and lines
+ * starting with # are skipped.
+ *
+ * The queries are sorted by file and position, so each file is looked up once
+ * and repeated locations are resolved once, then every query gets a
+ * clang_getCursor against the same translation unit.  Results are written in
+ * the order of the queries, each one after a header naming the query, and
+ * everything -L would show (-r, --where...) applies to each of them.  In
+ * binary output the translation_unit column holds the query instead.
+ * */
+
+using namespace std;
+
+bool read_location_queries(istream &in, const string &default_file,
+                           vector<LocationQuery> &queries) {
+  string line;
+  size_t line_number = 0;
+  while (getline(in, line)) {
+    ++line_number;
+    istringstream fields(line);
+    vector<string> words;
+    string word;
+    while (fields >> word) {
+      words.push_back(word);
+    }
+    if (words.empty() || words[0][0] == '#') {
+      continue;
+    }
+    if (words.size() != 2 && words.size() != 3) {
+      cerr << "query " << line_number << ": expected [file] line col" << endl;
+      return false;
+    }
+    LocationQuery query;
+    query.file = words.size() == 3 ? words[0] : default_file;
+    query.line = (unsigned)atol(words[words.size() - 2].c_str());
+    query.col = (unsigned)atol(words[words.size() - 1].c_str());
+    queries.push_back(query);
+  }
+  return true;
+}
+
+static string query_key(const LocationQuery &query) {
+  return query.file + ':' + to_string(query.line) + ':' + to_string(query.col);
+}
+
+static void append_query_header(string &result, size_t number,
+                                const LocationQuery &query,
+                                const Options &options, bool found) {
+  if (options.format == OutputFormat::NDJSON) {
+    result += "{\"query\":" + to_string(number) + ",\"file\":";
+    append_json_string(result, query.file.c_str());
+    result += ",\"line\":" + to_string(query.line) +
+              ",\"col\":" + to_string(query.col);
+    result += found ? "}\n" : ",\"error\":\"not in translation unit\"}\n";
+    return;
+  }
+  result += "query " + to_string(number) + ": " + query_key(query) + '\n';
+  if (!found) {
+    result += "not in translation unit\n";
+  }
+}
+
+int run_location_queries(const Options &options, CXTranslationUnit TU,
+                         OutputSink &out) {
+  vector<LocationQuery> queries;
+  bool read;
+  if (options.query_file == "-") {
+    read = read_location_queries(cin, options.source, queries);
+  } else {
+    ifstream in(options.query_file);
+    if (!in) {
+      cerr << "could not open " << options.query_file << endl;
+      return 1;
+    }
+    read = read_location_queries(in, options.source, queries);
+  }
+  if (!read) {
+    return 1;
+  }
+
+  vector<size_t> order(queries.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    const LocationQuery &x = queries[a];
+    const LocationQuery &y = queries[b];
+    if (x.file != y.file) {
+      return x.file < y.file;
+    }
+    return x.line != y.line ? x.line < y.line : x.col < y.col;
+  });
+
+  // null cursors for the queries whose file isn't part of the translation unit
+  vector<CXCursor> cursors(queries.size(), clang_getNullCursor());
+  const LocationQuery *previous = nullptr;
+  CXFile file = nullptr;
+  for (size_t i : order) {
+    const LocationQuery &query = queries[i];
+    if (previous == nullptr || previous->file != query.file) {
+      file = clang_getFile(TU, query.file.c_str());
+    } else if (previous->line == query.line && previous->col == query.col) {
+      cursors[i] = cursors[previous - queries.data()];
+      continue;
+    }
+    previous = &query;
+    if (file != nullptr) {
+      cursors[i] = clang_getCursor(
+          TU, clang_getLocation(TU, file, query.line, query.col));
+    }
+  }
+
+  unique_ptr<ColumnarDump> columns;
+  if (options.format == OutputFormat::Binary) {
+    columns.reset(new ColumnarDump(options.resolved_attributes));
+  }
+  for (size_t i = 0; i < queries.size(); ++i) {
+    bool found = !clang_Cursor_isNull(cursors[i]);
+    if (columns) {
+      columns->begin_translation_unit(query_key(queries[i]));
+      if (found) {
+        dump_cursor_tree(cursors[i], options, *columns);
+      }
+      continue;
+    }
+    append_query_header(out.buffer(), i, queries[i], options, found);
+    if (found) {
+      dump_cursor_tree(cursors[i], options, out);
+    }
+    out.record_done();
+  }
+  if (columns) {
+    columns->write(out);
+  }
+  out.flush();
+  return 0;
+}
@@ -0,0 +1,26 @@
+//location_queries.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <istream>
+#include <string>
+#include <vector>
+
+struct Options;
+class OutputSink;
+
+/*
+ * See location_queries.cc for more detailed commentary
+ */
+
+struct LocationQuery {
+  std::string file;
+  unsigned line;
+  unsigned col;
+};
+
+bool read_location_queries(std::istream &in, const std::string &default_file,
+                           std::vector<LocationQuery> &queries);
+int run_location_queries(const Options &options, CXTranslationUnit TU,
+                         OutputSink &out);
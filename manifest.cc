@@ -0,0 +1,262 @@
+// manifest.cc
+
+#include "manifest.h"
+#include "parse_cxcursor_info_options.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+#include <sys/stat.h>
+
+/* -n directory makes project mode incremental.  The directory keeps the output
+ * of every translation unit as a separate fragment, and a manifest recording,
+ * for each translation unit, the hash of its source, of its flags (together
+ * with everything on the command line that changes the output) and of every
+ * file it included, as clang_getInclusions reported them.  On the next run a
+ * translation unit whose hashes all still match isn't parsed at all, its old
+ * fragment is spliced into the output in its place.  The rest are dumped as
+ * usual and their fragments replaced.  The manifest is a text file:
+ *
+ *   tu <source hash> <flags hash> <file>
+ *   inc <hash> <file>                     once per included file
+ *
+ * Included files are hashed at most once per run, however many translation
+ * units include them.  Their names are made absolute against the directory
+ * the translation unit was compiled in (clang names them as the include path
+ * found them, e.g. inc/common.h with -Iinc), so a run works from any
+ * directory.  An included file that can't be read is recorded with the hash
+ * unreadable_hash, which no readable file is taken to have, so the translation
+ * unit is parsed again next time instead of losing its entry.  -D and -U are
+ * refused, since what they write for one translation unit depends on the
+ * others.
+ *
+ * The shards of a -k run can share a directory: a sharded run keeps the
+ * entries and fragments of the translation units it wasn't given as they
+ * were, so each shard only replaces its own.  Translation units gone from the
+ * database are then only dropped by the next run without -k.
+ * */
+
+using namespace std;
+
+static const char *manifest_name = "/manifest";
+static const ContentHash unreadable_hash = 0;
+
+static const char *fragment_extension(const Options &options) {
+  if (!options.index_output.empty()) {
+    return ".syms";
+  }
+  switch (options.format) {
+  case OutputFormat::NDJSON:
+    return ".ndjson";
+  case OutputFormat::Binary:
+    return ".cols";
+  case OutputFormat::Text:
+    break;
+  }
+  return ".txt";
+}
+
+/*
+ * Everything but the paths and the number of jobs, since those don't change
+ * what a translation unit's fragment looks like.
+ */
+static ContentHash output_options_hash(const Options &options) {
+  ContentHash hash = hash_string(string_ClangVersion());
+  hash = hash_string(fragment_extension(options), hash);
+  for (CursorAttribute attribute : options.resolved_attributes) {
+    hash = hash_string(attribute_entry(attribute).name, hash);
+  }
+  int settings[] = {options.recurse,
+                    options.max_depth,
+                    options.verbose,
+                    (int)options.parse_profile,
+                    (int)options.backend};
+  hash = hash_bytes((const char *)settings, sizeof(settings), hash);
+  return hash_string(options.where, hash);
+}
+
+Manifest::Manifest(const string &d, const Options &options)
+    : directory(d), extension(fragment_extension(options)),
+      options_hash(output_options_hash(options)),
+      sharded(options.shard_count != 0) {}
+
+bool Manifest::load() {
+  mkdir(directory.c_str(), 0755);
+  ifstream in(directory + manifest_name);
+  if (!in) {
+    // the first run
+    return true;
+  }
+  string line;
+  ManifestEntry *entry = nullptr;
+  while (getline(in, line)) {
+    istringstream fields(line);
+    string tag;
+    string file;
+    ContentHash hash;
+    fields >> tag >> hex >> hash;
+    if (tag == "tu") {
+      ContentHash flags;
+      fields >> flags;
+      fields.ignore(1);
+      getline(fields, file);
+      entry = &previous[file];
+      entry->source = hash;
+      entry->flags = flags;
+    } else if (tag == "inc" && entry != nullptr) {
+      fields.ignore(1);
+      getline(fields, file);
+      entry->includes.emplace_back(file, hash);
+    } else {
+      return false;
+    }
+    if (!fields && !fields.eof()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Manifest::file_hash(const string &path, ContentHash &hash) {
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = file_hashes.find(path);
+    if (it != file_hashes.end()) {
+      hash = it->second;
+      return true;
+    }
+  }
+  if (!hash_file(path, hash)) {
+    return false;
+  }
+  lock_guard<mutex> guard(lock);
+  file_hashes.emplace(path, hash);
+  return true;
+}
+
+ContentHash Manifest::flags_hash(const CompileJob &job) const {
+  ContentHash hash = hash_string(job.directory, options_hash);
+  for (auto &&arg : job.args) {
+    hash = hash_string(arg, hash);
+  }
+  return hash;
+}
+
+/*
+ * A translation unit that is up to date keeps its manifest entry.
+ */
+bool Manifest::up_to_date(const CompileJob &job) {
+  const ManifestEntry *entry;
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = previous.find(job.filename);
+    if (it == previous.end()) {
+      return false;
+    }
+    entry = &it->second;
+  }
+  ContentHash hash;
+  if (entry->flags != flags_hash(job) || entry->source == unreadable_hash ||
+      !file_hash(job.filename, hash) || hash != entry->source) {
+    return false;
+  }
+  for (auto &&include : entry->includes) {
+    if (include.second == unreadable_hash || !file_hash(include.first, hash) ||
+        hash != include.second) {
+      return false;
+    }
+  }
+  struct stat info;
+  if (stat(fragment_path(job).c_str(), &info) != 0) {
+    return false;
+  }
+  lock_guard<mutex> guard(lock);
+  current[job.filename] = *entry;
+  return true;
+}
+
+/*
+ * Anything that can't be hashed is recorded as unreadable, so the fragment
+ * just written is kept but not reused.
+ */
+void Manifest::record(const CompileJob &job, CXTranslationUnit TU) {
+  ManifestEntry entry;
+  entry.flags = flags_hash(job);
+  if (!file_hash(job.filename, entry.source)) {
+    entry.source = unreadable_hash;
+  }
+  for (auto &&include : included_files(TU, job.directory)) {
+    ContentHash hash;
+    if (!file_hash(include, hash)) {
+      hash = unreadable_hash;
+    }
+    entry.includes.emplace_back(include, hash);
+  }
+  lock_guard<mutex> guard(lock);
+  current[job.filename] = std::move(entry);
+}
+
+string Manifest::fragment_path(const CompileJob &job) const {
+  return directory + "/" + string_hash(hash_string(job.filename)) + extension;
+}
+
+/*
+ * Only the translation units of this run are kept, the fragments of the ones
+ * that left the database are removed.
+ */
+static void write_entry(ostream &out, const string &file,
+                        const ManifestEntry &entry) {
+  out << "tu " << entry.source << ' ' << entry.flags << ' ' << file << '\n';
+  for (auto &&include : entry.includes) {
+    out << "inc " << include.second << ' ' << include.first << '\n';
+  }
+}
+
+/*
+ * With -k, jobs is only this shard's part of the database, and the entries of
+ * the other shards are carried over, in name order.
+ */
+bool Manifest::save(const vector<CompileJob> &jobs) {
+  unordered_set<string> given;
+  for (auto &&job : jobs) {
+    given.insert(job.filename);
+  }
+  vector<string> others;
+  if (sharded) {
+    for (auto &&entry : previous) {
+      if (given.count(entry.first) == 0) {
+        others.push_back(entry.first);
+      }
+    }
+    sort(others.begin(), others.end());
+  }
+  string path = directory + manifest_name;
+  string temporary = path + ".tmp";
+  {
+    ofstream out(temporary);
+    out << hex;
+    for (auto &&job : jobs) {
+      auto it = current.find(job.filename);
+      if (it != current.end()) {
+        write_entry(out, job.filename, it->second);
+      }
+    }
+    for (auto &&file : others) {
+      write_entry(out, file, previous[file]);
+    }
+    if (!out) {
+      remove(temporary.c_str());
+      return false;
+    }
+  }
+  for (auto &&entry : previous) {
+    if (current.find(entry.first) == current.end() &&
+        (!sharded || given.count(entry.first) != 0)) {
+      remove(fragment_path(CompileJob{"", entry.first, {}}).c_str());
+    }
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,46 @@
+//manifest.h
+#pragma once
+
+#include "project_mode.h"
+#include "tu_cache.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct Options;
+
+/*
+ * See manifest.cc for more detailed commentary
+ */
+
+struct ManifestEntry {
+  ContentHash source;
+  ContentHash flags;
+  std::vector<std::pair<std::string, ContentHash>> includes;
+};
+
+class Manifest {
+public:
+  Manifest(const std::string &directory, const Options &options);
+  bool load();
+  bool up_to_date(const CompileJob &job);
+  void record(const CompileJob &job, CXTranslationUnit TU);
+  std::string fragment_path(const CompileJob &job) const;
+  bool save(const std::vector<CompileJob> &jobs);
+
+private:
+  std::string directory;
+  std::string extension;
+  ContentHash options_hash;
+  bool sharded;
+  std::mutex lock;
+  std::unordered_map<std::string, ManifestEntry> previous;
+  std::unordered_map<std::string, ManifestEntry> current;
+  std::unordered_map<std::string, ContentHash> file_hashes;
+
+  bool file_hash(const std::string &path, ContentHash &hash);
+  ContentHash flags_hash(const CompileJob &job) const;
+};
@@ -0,0 +1,175 @@
+// mem_stats.cc
+
+#include "mem_stats.h"
+#include "cxcursor_info.h"
+#include "output_sink.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* --mem-stats file says where the memory of a run went, one line of JSON per
+ * translation unit as soon as it is done, so the file is there to read even
+ * after the run was killed for running out of memory:
+ *
+ *   file            the translation unit
+ *   peak_rss, rss   the process' peak and current resident size, in bytes,
+ *                   right after parsing it (with -j, of every thread at once)
+ *   clang           clang_getCXTUResourceUsage, bytes by kind
+ *   id_table        cursors in the CustomId table after the walk, and the
+ *                   bytes it takes
+ *   output_bytes    what was dumped for it, in text or NDJSON
+ *
+ * and a last line with the totals: translation units, peak RSS, the most
+ * any translation unit took (and which one), the sum of the clang usage by
+ * kind, the largest id table and all the output.
+ * */
+
+using namespace std;
+
+bool memory_stats_enabled = false;
+
+namespace {
+struct MemoryTotals {
+  size_t translation_units = 0;
+  size_t peak_rss = 0;
+  string largest_file;
+  unsigned long largest = 0;
+  map<string, unsigned long> clang;
+  size_t id_table_entries = 0;
+  size_t id_table_bytes = 0;
+  size_t output_bytes = 0;
+};
+} // namespace
+
+static mutex report_mutex;
+static ofstream report_file;
+static ostream *report = nullptr;
+static MemoryTotals totals;
+
+static size_t peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // Linux reports kilobytes
+  return (size_t)usage.ru_maxrss * 1024;
+}
+
+static size_t current_rss() {
+  ifstream statm("/proc/self/statm");
+  size_t pages = 0;
+  size_t resident = 0;
+  if (!(statm >> pages >> resident)) {
+    return 0;
+  }
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void measure_parse(TUMemory &memory, CXTranslationUnit TU) {
+  memory.peak_rss = peak_rss();
+  memory.rss = current_rss();
+  CXTUResourceUsage usage = clang_getCXTUResourceUsage(TU);
+  for (unsigned i = 0; i < usage.numEntries; ++i) {
+    const char *name = clang_getTUResourceUsageName(usage.entries[i].kind);
+    memory.clang.emplace_back(name != nullptr ? name : "unknown",
+                              usage.entries[i].amount);
+  }
+  clang_disposeCXTUResourceUsage(usage);
+}
+
+void measure_traversal(TUMemory &memory) {
+  memory.id_table_entries = id_table_size();
+  memory.id_table_bytes = id_table_memory();
+}
+
+template <typename Usage>
+static void append_usage(string &result, const Usage &usage) {
+  result += '{';
+  bool first = true;
+  for (auto &&entry : usage) {
+    if (!first) {
+      result += ',';
+    }
+    first = false;
+    append_json_string(result, entry.first.c_str());
+    result += ':' + to_string(entry.second);
+  }
+  result += '}';
+}
+
+void report_memory(const TUMemory &memory) {
+  string line = "{\"file\":";
+  append_json_string(line, memory.file.c_str());
+  line += ",\"peak_rss\":" + to_string(memory.peak_rss);
+  line += ",\"rss\":" + to_string(memory.rss);
+  line += ",\"clang\":";
+  append_usage(line, memory.clang);
+  line += ",\"id_table\":{\"entries\":" + to_string(memory.id_table_entries);
+  line += ",\"bytes\":" + to_string(memory.id_table_bytes);
+  line += "},\"output_bytes\":" + to_string(memory.output_bytes) + "}\n";
+
+  unsigned long clang_total = 0;
+  lock_guard<mutex> guard(report_mutex);
+  for (auto &&entry : memory.clang) {
+    totals.clang[entry.first] += entry.second;
+    clang_total += entry.second;
+  }
+  ++totals.translation_units;
+  totals.peak_rss = max(totals.peak_rss, memory.peak_rss);
+  if (clang_total > totals.largest || totals.largest_file.empty()) {
+    totals.largest = clang_total;
+    totals.largest_file = memory.file;
+  }
+  totals.id_table_entries =
+      max(totals.id_table_entries, memory.id_table_entries);
+  totals.id_table_bytes = max(totals.id_table_bytes, memory.id_table_bytes);
+  totals.output_bytes += memory.output_bytes;
+  if (report != nullptr) {
+    *report << line << flush;
+  }
+}
+
+MemoryReport::MemoryReport(const string &path) {
+  if (path.empty()) {
+    return;
+  }
+  if (path == "-") {
+    report = &cerr;
+  } else {
+    report_file.open(path);
+    if (!report_file) {
+      cerr << "could not write the memory statistics to " << path << endl;
+      return;
+    }
+    report = &report_file;
+  }
+  memory_stats_enabled = true;
+}
+
+MemoryReport::~MemoryReport() {
+  if (!memory_stats_enabled) {
+    return;
+  }
+  memory_stats_enabled = false;
+  lock_guard<mutex> guard(report_mutex);
+  string line = "{\"translation_units\":" + to_string(totals.translation_units);
+  line += ",\"peak_rss\":" + to_string(max(totals.peak_rss, peak_rss()));
+  line += ",\"largest\":";
+  append_json_string(line, totals.largest_file.c_str());
+  line += ",\"largest_clang_bytes\":" + to_string(totals.largest);
+  line += ",\"clang\":";
+  append_usage(line, totals.clang);
+  line += ",\"id_table\":{\"entries\":" + to_string(totals.id_table_entries);
+  line += ",\"bytes\":" + to_string(totals.id_table_bytes);
+  line += "},\"output_bytes\":" + to_string(totals.output_bytes) + "}\n";
+  *report << line << flush;
+  report = nullptr;
+  report_file.close();
+}
@@ -0,0 +1,41 @@
+//mem_stats.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * See mem_stats.cc for more detailed commentary
+ */
+
+struct TUMemory {
+  std::string file;
+  std::size_t peak_rss = 0;
+  std::size_t rss = 0;
+  std::vector<std::pair<std::string, unsigned long>> clang;
+  std::size_t id_table_entries = 0;
+  std::size_t id_table_bytes = 0;
+  std::size_t output_bytes = 0;
+};
+
+extern bool memory_stats_enabled;
+
+void measure_parse(TUMemory &memory, CXTranslationUnit TU);
+void measure_traversal(TUMemory &memory);
+void report_memory(const TUMemory &memory);
+
+/*
+ * Turns the memory statistics on for its lifetime when given a path, and
+ * finishes them with the totals when it goes.
+ */
+class MemoryReport {
+public:
+  explicit MemoryReport(const std::string &path);
+  ~MemoryReport();
+  MemoryReport(const MemoryReport &) = delete;
+  MemoryReport &operator=(const MemoryReport &) = delete;
+};
@@ -0,0 +1,112 @@
+// output_sink.cc
+
+#include "output_sink.h"
+#include "profiler.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Everything the dump produces goes through an OutputSink.  Records are
+ * appended straight into one big reusable buffer, which is handed to write(2)
+ * once it passes flush_size, instead of flushing std::cout at every line.
+ * A sink without a file descriptor just keeps what it is given, which is how
+ * project mode collects a translation unit on a worker thread.
+ * */
+
+using namespace std;
+
+OutputSink::OutputSink() : fd(-1), owns_fd(false), written(0) {}
+
+OutputSink::OutputSink(int f) : fd(f), owns_fd(false), written(0) {
+  data.reserve(flush_size + flush_size / 4);
+}
+
+OutputSink::~OutputSink() {
+  flush();
+  if (owns_fd) {
+    close(fd);
+  }
+}
+
+bool OutputSink::open(const string &path) {
+  flush();
+  int new_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (new_fd < 0) {
+    return false;
+  }
+  if (owns_fd) {
+    close(fd);
+  }
+  fd = new_fd;
+  owns_fd = true;
+  data.reserve(flush_size + flush_size / 4);
+  return true;
+}
+
+bool OutputSink::flush() {
+  if (fd < 0) {
+    return true;
+  }
+  PhaseTimer timer(ProfilePhase::Write);
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t result = ::write(fd, data.data() + done, data.size() - done);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      data.erase(0, done);
+      written += done;
+      return false;
+    }
+    done += (size_t)result;
+  }
+  written += done;
+  data.clear();
+  return true;
+}
+
+/*
+ * Quotes and escapes str as a JSON string.  Bytes above 0x7f are passed
+ * through as they are, on the assumption that the source is UTF-8.
+ */
+void append_json_string(string &result, const char *str) {
+  result += '"';
+  for (const char *c = str; *c != '\0'; ++c) {
+    switch (*c) {
+    case '"':
+      result += "\\\"";
+      break;
+    case '\\':
+      result += "\\\\";
+      break;
+    case '\n':
+      result += "\\n";
+      break;
+    case '\r':
+      result += "\\r";
+      break;
+    case '\t':
+      result += "\\t";
+      break;
+    case '\b':
+      result += "\\b";
+      break;
+    case '\f':
+      result += "\\f";
+      break;
+    default:
+      if ((unsigned char)*c < 0x20) {
+        char buffer[8];
+        snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)*c);
+        result += buffer;
+      } else {
+        result += *c;
+      }
+    }
+  }
+  result += '"';
+}
@@ -0,0 +1,39 @@
+//output_sink.h
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+ * See output_sink.cc for more detailed commentary
+ */
+
+class OutputSink {
+public:
+  OutputSink();
+  explicit OutputSink(int fd);
+  ~OutputSink();
+  OutputSink(const OutputSink &) = delete;
+  OutputSink &operator=(const OutputSink &) = delete;
+
+  bool open(const std::string &path);
+  std::string &buffer() { return data; }
+  void append(const std::string &str) { data += str; }
+  void record_done() {
+    if (fd >= 0 && data.size() >= flush_size) {
+      flush();
+    }
+  }
+  bool flush();
+  std::size_t bytes_written() const { return written + data.size(); }
+
+  static const std::size_t flush_size = 1 << 20;
+
+private:
+  int fd;
+  bool owns_fd;
+  std::size_t written;
+  std::string data;
+};
+
+void append_json_string(std::string &result, const char *str);
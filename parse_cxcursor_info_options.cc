@@ -2,6 +2,7 @@
 
 #include "parse_cxcursor_info_options.h"
 #include <iostream>
+#include <sstream>
 
 std::string newlines_on_size(const std::string &str, size_t width) {
   std::string result;
@@ -25,24 +26,88 @@ std::string newlines_on_size(const std::string &str, size_t width) {
 }
 
 std::string usage =
-    "[options] [-L location] -f sourcefile\n\n" +
+    "[options] [-L location] -f sourcefile\n"
+    "       [options] -p build_directory [-j jobs]\n"
+    "       [options] -s -f sourcefile\n"
+    "       -Q index usr [-Q index usr...]\n"
+    "       [options] [-p build_directory] -S socket\n\n" +
     newlines_on_size(
         "Options either specify which information to show or "
         "describe the descent behavior.  The location should be "
         "specified as [line_number column_number], indicating "
         "where to start examining CXCursors.  If no location is "
         "specified, then the CXCursor of origin will be the "
-        "Tranlation Unit cursor.  If attributes are indicate in the "
-        "arguments, then only those attributes will be listed.\n\n"
-        "I know it's cheesy, but the -f is mandtory, because I'm lazy.");
+        "Tranlation Unit cursor.  Only that cursor is shown, unless -r or "
+        "-d asks for the ones below it too.  If attributes are indicate in "
+        "the arguments, then only those attributes will be listed.\n\n"
+        "I know it's cheesy, but the -f is mandtory, because I'm lazy.  "
+        "The exception is project mode: -p names a directory holding a "
+        "compile_commands.json, and every translation unit in it is parsed "
+        "with its recorded flags and dumped in database order (add -r to "
+        "dump every cursor rather than each translation unit's own).");
 
 std::list<OptionTriple> option_list = {
     {"-r", "--recurse",
      "when a cursor is found to examine, recurse into its subtree"},
+    {"-d", "--max-depth",
+     "recurse, but no more than this many levels below the cursor"},
+    {"-w", "--where", "only dump cursors for which this expression over "
+                      "attribute names holds (see cursor_filter.cc)"},
     {"-v", "--verbose",
      "display failed predicates and empty attributes"},
     {"-o", "--omit", "only display the collect information about "
-                     "attributes not indicated in the options"}};
+                     "attributes not indicated in the options"},
+    {"-q", "--queries", "answer every \"[file] line col\" line of this file "
+                        "(- for stdin) against one parse of the source"},
+    {"-p", "--project", "dump every translation unit listed in the "
+                        "compile_commands.json found in this directory"},
+    {"-j", "--jobs", "number of worker threads used in project mode, "
+                     "defaults to the number of cores"},
+    {"-b", "--memory-budget", "with -p, keep the output and symbol tables "
+                              "waiting in memory under this many MiB, "
+                              "spilling the rest to temporary files"},
+    {"-c", "--cache", "directory of saved ASTs, so an unchanged translation "
+                      "unit is loaded instead of parsed"},
+    {"-n", "--incremental", "with -p, keep every translation unit's output in "
+                            "this directory and only dump the ones that "
+                            "changed since (see manifest.cc)"},
+    {"-H", "--history", "with -p, keep the time each translation unit took "
+                        "in this file, to start the longest ones first "
+                        "(see job_scheduler.cc)"},
+    {"-k", "--shard", "with -p, only dump shard i/N of the translation units, "
+                      "split evenly by source size (see shard_merge.cc)"},
+    {"-m", "--merge", "merge the dumps or indexes named by the remaining "
+                      "arguments into one, as written by the shards of -k"},
+    {"-s", "--session", "keep the source loaded and answer location queries "
+                        "and edits read from stdin (see session_mode.cc)"},
+    {"-U", "--usr-ids", "give cursors with a USR the same CustomId in every "
+                        "translation unit"},
+    {"-D", "--dedup", "write each declaration once per run, skipping the "
+                      "copies of shared headers (see declaration_set.cc)"},
+    {"-O", "--output", "write the dump to this file instead of stdout"},
+    {"-T", "--profile", "write a JSON report of where the time went, by "
+                        "phase and by attribute, to this file (or - for "
+                        "stderr, see profiler.cc)"},
+    {"-R", "--mem-stats", "write the memory taken by every translation unit, "
+                          "and in total, to this file as JSON (or - for "
+                          "stderr, see mem_stats.cc)"},
+    {"-F", "--format", "text (the default), ndjson (one JSON object per "
+                       "cursor) or binary (columns, see columnar_dump.cc)"},
+    {"-P", "--parse-profile", "full (the default) or decls, which skips "
+                              "function bodies and keeps going past errors, "
+                              "for quick dumps of declarations"},
+    {"-B", "--backend", "visit (the default) walks the cursors, the whole AST "
+                        "with -r; index and session report every declaration "
+                        "and reference through libclang's indexer, whatever "
+                        "-r says (see index_backend.cc)"},
+    {"-I", "--index", "instead of dumping cursors, write a symbol index of "
+                      "definitions and references to this file"},
+    {"-Q", "--query", "look up a USR in a symbol index written by -I, "
+                      "takes the index and the USR"},
+    {"-S", "--serve", "keep translation units loaded and answer queries on "
+                      "this Unix socket (see query_daemon.cc)"},
+    {"-M", "--max-tus", "how many translation units the daemon keeps loaded, "
+                        "8 by default"}};
 
 struct SupportedAttributeTriple {
   std::string short_opt;
@@ -111,7 +176,12 @@ std::list<SupportedAttributeTriple> supported_attributes = {
     {"-sto", "--StorageClass"}
 };
 
-Options::Options() : recurse(false), verbose(false), line(0), col(0) {}
+Options::Options()
+    : recurse(false), max_depth(-1), verbose(false), line(0), col(0), jobs(0),
+      memory_budget(0), shard_index(0), shard_count(0), session(false),
+      usr_ids(false), dedup(false), format(OutputFormat::Text),
+      parse_profile(ParseProfile::Full), backend(Backend::Visit),
+      max_tus(8) {}
 
 std::string Options::help(const std::string &name) {
   std::string result = "Usage" + name + usage + "\n\n";
@@ -128,6 +198,7 @@ std::string Options::help(const std::string &name) {
   result += "\n\nExamples:\n\n";
   result +=
       "./cxcursor_info -r -ref -ts -tks -cid -sp -loc -L 12 1 -f test2.cc\n";
+  result += "./cxcursor_info -r -usr -loc -def -j 8 -p build/\n";
   return result;
 }
 
@@ -186,7 +257,8 @@ std::list<std::string> get_message_split(const OptionTriple &triple) {
 std::string get_attribute_key_from_option(const std::string &option) {
   for (auto &&sa : supported_attributes) { 
     if (option == sa.short_opt || option == sa.attribute_key) {
-      return sa.attribute_key;
+      // the attribute names themselves don't have the leading dashes
+      return sa.attribute_key.substr(2);
     }
   }
   return "";
@@ -214,6 +286,22 @@ bool parse_options(Options &options,
     arg = argv[i];
     if (arg == "-r" || arg == "--recurse") {
       options.recurse = true;
+    } else if (arg == "-d" || arg == "--max-depth") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.recurse = true;
+      options.max_depth = atoi(argv[i]);
+    } else if (arg == "-w" || arg == "--where") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.where = argv[i];
+      std::string error;
+      if (!options.filter.compile(options.where, error)) {
+        std::cerr << "bad --where expression: " << error << std::endl;
+        return false;
+      }
     } else if (arg == "-o" || arg == "--omit") {
       invert = true;
     } else if (arg == "-v" || arg == "--verbose") {
@@ -224,12 +312,144 @@ bool parse_options(Options &options,
       }
       options.line = (size_t)atol(argv[++i]);
       options.col = (size_t)atol(argv[++i]);
+    } else if (arg == "-n" || arg == "--incremental") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.incremental = argv[i];
+    } else if (arg == "-H" || arg == "--history") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.history = argv[i];
+    } else if (arg == "-k" || arg == "--shard") {
+      if (++i >= argc) {
+        return false;
+      }
+      char slash = 0;
+      std::istringstream shard(argv[i]);
+      if (!(shard >> options.shard_index >> slash >> options.shard_count) ||
+          slash != '/' || options.shard_index >= options.shard_count) {
+        std::cerr << "expected -k i/N with i < N" << std::endl;
+        return false;
+      }
+    } else if (arg == "-m" || arg == "--merge") {
+      for (++i; i < argc; ++i) {
+        options.merge_inputs.push_back(argv[i]);
+      }
+    } else if (arg == "-D" || arg == "--dedup") {
+      options.dedup = true;
+    } else if (arg == "-q" || arg == "--queries") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.query_file = argv[i];
     } else if (arg == "-f") {
       if (++i >= argc) {
         return false;
       }
       options.source = argv[i];
       have_source = true;
+    } else if (arg == "-p" || arg == "--project") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.project = argv[i];
+    } else if (arg == "-j" || arg == "--jobs") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.jobs = (size_t)atol(argv[i]);
+    } else if (arg == "-b" || arg == "--memory-budget") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.memory_budget = (size_t)(atof(argv[i]) * 1024 * 1024);
+    } else if (arg == "-c" || arg == "--cache") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.cache = argv[i];
+    } else if (arg == "-s" || arg == "--session") {
+      options.session = true;
+    } else if (arg == "-U" || arg == "--usr-ids") {
+      options.usr_ids = true;
+    } else if (arg == "-T" || arg == "--profile") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.profile = argv[i];
+    } else if (arg == "-R" || arg == "--mem-stats") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.mem_stats = argv[i];
+    } else if (arg == "-O" || arg == "--output") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.output = argv[i];
+    } else if (arg == "-F" || arg == "--format") {
+      if (++i >= argc) {
+        return false;
+      }
+      std::string format = argv[i];
+      if (format == "text") {
+        options.format = OutputFormat::Text;
+      } else if (format == "ndjson") {
+        options.format = OutputFormat::NDJSON;
+      } else if (format == "binary") {
+        options.format = OutputFormat::Binary;
+      } else {
+        return false;
+      }
+    } else if (arg == "-P" || arg == "--parse-profile") {
+      if (++i >= argc) {
+        return false;
+      }
+      std::string profile = argv[i];
+      if (profile == "full") {
+        options.parse_profile = ParseProfile::Full;
+      } else if (profile == "decls") {
+        options.parse_profile = ParseProfile::Decls;
+      } else {
+        return false;
+      }
+    } else if (arg == "-B" || arg == "--backend") {
+      if (++i >= argc) {
+        return false;
+      }
+      std::string backend = argv[i];
+      if (backend == "visit") {
+        options.backend = Backend::Visit;
+      } else if (backend == "index") {
+        options.backend = Backend::Index;
+      } else if (backend == "session") {
+        options.backend = Backend::IndexSession;
+      } else {
+        return false;
+      }
+    } else if (arg == "-I" || arg == "--index") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.index_output = argv[i];
+    } else if (arg == "-Q" || arg == "--query") {
+      if (i + 2 >= argc) {
+        return false;
+      }
+      options.query_index = argv[++i];
+      options.query_usrs.push_back(argv[++i]);
+    } else if (arg == "-S" || arg == "--serve") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.socket_path = argv[i];
+    } else if (arg == "-M" || arg == "--max-tus") {
+      if (++i >= argc) {
+        return false;
+      }
+      options.max_tus = (size_t)atol(argv[i]);
     } else {
       std::string attribute = get_attribute_key_from_option(arg);
       if (attribute.empty()) {
@@ -253,12 +473,25 @@ bool parse_options(Options &options,
     options.chosen_attributes = inverted;
   }
   options.chosen_attributes.sort();
-  return have_source;
+  // resolve the names once, so the traversal never has to look them up
+  options.resolved_attributes.clear();
+  for (auto &&attribute : options.chosen_attributes) {
+    CursorAttribute resolved;
+    if (!find_attribute(attribute, resolved)) {
+      std::cerr << "unknown attribute in the mix: " << attribute << std::endl;
+      continue;
+    }
+    options.resolved_attributes.push_back(resolved);
+  }
+  return have_source || !options.project.empty() ||
+         !options.query_index.empty() || !options.socket_path.empty() ||
+         !options.merge_inputs.empty();
 }
 
 std::string Options::dump() const {
   std::string result =
-      "{recurse: " + std::to_string(recurse) + ",\nchosen_attributes: {\n";
+      "{recurse: " + std::to_string(recurse) +
+      ", max_depth: " + std::to_string(max_depth) + ",\nchosen_attributes: {\n";
   for (auto &&attribute = chosen_attributes.begin();
        attribute != chosen_attributes.end(); ++attribute) {
     result += "\t" + *attribute;
@@ -268,6 +501,47 @@ std::string Options::dump() const {
     result += "\n";
   }
   result += "},\nsource: " + source + ", line: " + std::to_string(line) +
-            ", col: " + std::to_string(col) + "}";
+            ", col: " + std::to_string(col);
+  if (!project.empty()) {
+    result += ",\nproject: " + project + ", jobs: " + std::to_string(jobs);
+  }
+  if (!cache.empty()) {
+    result += ",\ncache: " + cache;
+  }
+  if (!incremental.empty()) {
+    result += ",\nincremental: " + incremental;
+  }
+  if (!history.empty()) {
+    result += ",\nhistory: " + history;
+  }
+  if (memory_budget != 0) {
+    result += ",\nmemory budget: " + std::to_string(memory_budget);
+  }
+  if (shard_count != 0) {
+    result += ",\nshard: " + std::to_string(shard_index) + "/" +
+              std::to_string(shard_count);
+  }
+  if (parse_profile == ParseProfile::Decls) {
+    result += ",\nparse profile: decls";
+  }
+  if (backend != Backend::Visit) {
+    result += ",\nbackend: indexer";
+  }
+  if (!query_file.empty()) {
+    result += ",\nqueries: " + query_file;
+  }
+  if (dedup) {
+    result += ",\ndedup: 1";
+  }
+  if (!where.empty()) {
+    result += ",\nwhere: " + where;
+  }
+  if (!output.empty()) {
+    result += ",\noutput: " + output;
+  }
+  if (!index_output.empty()) {
+    result += ",\nindex: " + index_output;
+  }
+  result += "}";
   return result;
 }
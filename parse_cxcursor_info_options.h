@@ -1,17 +1,54 @@
 //parse_options.h
 #pragma once
 
+#include "cursor_filter.h"
+#include "cxcursor_info.h"
+
 #include <list>
 #include <string>
+#include <vector>
 
 std::string newlines_on_size(const std::string &str, size_t width = 80);
 
+enum class OutputFormat { Text, NDJSON, Binary };
+enum class ParseProfile { Full, Decls };
+enum class Backend { Visit, Index, IndexSession };
+
 struct Options {
   bool recurse;
+  int max_depth;
+  bool verbose;
   std::list<std::string> chosen_attributes;
+  std::vector<CursorAttribute> resolved_attributes;
+  std::string where;
+  CursorFilter filter;
   std::string source;
   size_t line;
   size_t col;
+  std::string query_file;
+  std::string project;
+  size_t jobs;
+  size_t memory_budget;
+  std::string cache;
+  std::string incremental;
+  std::string history;
+  size_t shard_index;
+  size_t shard_count;
+  std::vector<std::string> merge_inputs;
+  bool session;
+  bool usr_ids;
+  bool dedup;
+  std::string output;
+  std::string profile;
+  std::string mem_stats;
+  OutputFormat format;
+  ParseProfile parse_profile;
+  Backend backend;
+  std::string index_output;
+  std::string query_index;
+  std::vector<std::string> query_usrs;
+  std::string socket_path;
+  size_t max_tus;
 
   Options();
   std::string dump() const;
@@ -0,0 +1,233 @@
+// profiler.cc
+
+#include "profiler.h"
+#include "output_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* --profile file reports where the time of a run went, as JSON, so it can be
+ * kept and compared across clang versions:
+ *
+ *   wall_seconds, cursors, cursors_per_second
+ *   phases      seconds spent parsing (or indexing), walking the cursors,
+ *               asking for attributes (part of walking), formatting the
+ *               pipeline's batches (see project_mode.cc) and writing; summed
+ *               over threads, so with -j they can add up to more than the
+ *               wall time
+ *   attributes  for every attribute asked for: calls, total seconds, and the
+ *               mean, median, 90th and 99th percentile and maximum latency of
+ *               one call in microseconds, slowest attribute first
+ *
+ * Every attribute call is timed with the steady clock, which costs a couple of
+ * tens of nanoseconds, and nothing at all without --profile.  Latencies go
+ * into histograms with four buckets per power of two, so the percentiles are
+ * the middle of a bucket (or the slowest call, if less), within about 12% of
+ * the truth.  Each thread keeps its own counts, so timing never takes a lock;
+ * they are added up for the report, once the threads are done.
+ * */
+
+using namespace std;
+
+bool profiling_enabled = false;
+
+// below 16 ns every nanosecond has a bucket, above it four per power of two
+static const unsigned exact_buckets = 16;
+static const unsigned bucket_count = exact_buckets + 60 * 4;
+
+static unsigned latency_bucket(uint64_t nanoseconds) {
+  if (nanoseconds < exact_buckets) {
+    return (unsigned)nanoseconds;
+  }
+  unsigned log = 63 - (unsigned)__builtin_clzll(nanoseconds);
+  return exact_buckets + (log - 4) * 4 +
+         (unsigned)((nanoseconds >> (log - 2)) & 3);
+}
+
+static double bucket_middle(unsigned bucket) {
+  if (bucket < exact_buckets) {
+    return bucket;
+  }
+  unsigned log = (bucket - exact_buckets) / 4 + 4;
+  uint64_t quarter = uint64_t(1) << (log - 2);
+  uint64_t low = (4 + (bucket - exact_buckets) % 4) * quarter;
+  return (double)low + (double)quarter / 2;
+}
+
+namespace {
+struct AttributeProfile {
+  uint64_t calls;
+  uint64_t nanoseconds;
+  uint64_t slowest;
+  uint64_t buckets[bucket_count];
+};
+
+struct ThreadProfile {
+  uint64_t phases[profile_phase_count];
+  uint64_t cursors;
+  AttributeProfile attributes[attribute_count];
+};
+} // namespace
+
+static mutex profiles_mutex;
+static vector<unique_ptr<ThreadProfile>> profiles;
+static thread_local ThreadProfile *local_profile = nullptr;
+
+/*
+ * A thread's counts outlive it, so the report can still add them up.
+ */
+static ThreadProfile &thread_profile() {
+  if (local_profile == nullptr) {
+    lock_guard<mutex> guard(profiles_mutex);
+    profiles.emplace_back(new ThreadProfile());
+    local_profile = profiles.back().get();
+  }
+  return *local_profile;
+}
+
+uint64_t profile_clock(void) {
+  return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void profile_attribute(CursorAttribute attribute, uint64_t nanoseconds) {
+  AttributeProfile &profile =
+      thread_profile().attributes[(size_t)attribute];
+  ++profile.calls;
+  profile.nanoseconds += nanoseconds;
+  profile.slowest = max(profile.slowest, nanoseconds);
+  ++profile.buckets[latency_bucket(nanoseconds)];
+}
+
+void profile_phase(ProfilePhase phase, uint64_t nanoseconds) {
+  thread_profile().phases[(size_t)phase] += nanoseconds;
+}
+
+void profile_cursor(void) { ++thread_profile().cursors; }
+
+ProfileReport::ProfileReport(const string &p) : path(p), start(0) {
+  if (!path.empty()) {
+    profiling_enabled = true;
+    start = profile_clock();
+  }
+}
+
+static void append_number(string &result, double number) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", number);
+  result += buffer;
+}
+
+static double percentile(const AttributeProfile &profile, double fraction) {
+  uint64_t rank = (uint64_t)(fraction * (double)profile.calls);
+  uint64_t seen = 0;
+  for (unsigned bucket = 0; bucket < bucket_count; ++bucket) {
+    seen += profile.buckets[bucket];
+    if (seen > rank) {
+      return min(bucket_middle(bucket), (double)profile.slowest);
+    }
+  }
+  return (double)profile.slowest;
+}
+
+ProfileReport::~ProfileReport() {
+  if (path.empty()) {
+    return;
+  }
+  double wall = (double)(profile_clock() - start) / 1e9;
+  profiling_enabled = false;
+
+  ThreadProfile total = ThreadProfile();
+  {
+    lock_guard<mutex> guard(profiles_mutex);
+    for (auto &&profile : profiles) {
+      for (size_t phase = 0; phase < profile_phase_count; ++phase) {
+        total.phases[phase] += profile->phases[phase];
+      }
+      total.cursors += profile->cursors;
+      for (size_t i = 0; i < attribute_count; ++i) {
+        AttributeProfile &sum = total.attributes[i];
+        const AttributeProfile &part = profile->attributes[i];
+        sum.calls += part.calls;
+        sum.nanoseconds += part.nanoseconds;
+        sum.slowest = max(sum.slowest, part.slowest);
+        for (unsigned bucket = 0; bucket < bucket_count; ++bucket) {
+          sum.buckets[bucket] += part.buckets[bucket];
+        }
+      }
+    }
+  }
+
+  vector<size_t> order;
+  uint64_t attribute_nanoseconds = 0;
+  for (size_t i = 0; i < attribute_count; ++i) {
+    if (total.attributes[i].calls != 0) {
+      order.push_back(i);
+      attribute_nanoseconds += total.attributes[i].nanoseconds;
+    }
+  }
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return total.attributes[a].nanoseconds > total.attributes[b].nanoseconds;
+  });
+
+  string result = "{\"clang_version\":";
+  append_json_string(result, string_ClangVersion().c_str());
+  result += ",\"wall_seconds\":";
+  append_number(result, wall);
+  result += ",\"cursors\":" + to_string(total.cursors);
+  result += ",\"cursors_per_second\":";
+  append_number(result, wall > 0 ? (double)total.cursors / wall : 0);
+  const char *phase_names[] = {"parse", "traverse", "format", "write"};
+  result += ",\"phases\":{";
+  for (size_t phase = 0; phase < profile_phase_count; ++phase) {
+    result += '"';
+    result += phase_names[phase];
+    result += "\":";
+    append_number(result, (double)total.phases[phase] / 1e9);
+    result += ',';
+  }
+  result += "\"attributes\":";
+  append_number(result, (double)attribute_nanoseconds / 1e9);
+  result += "},\"attributes\":[";
+  for (size_t i : order) {
+    const AttributeProfile &profile = total.attributes[i];
+    if (i != order.front()) {
+      result += ',';
+    }
+    result += "{\"name\":";
+    append_json_string(result, attribute_entry((CursorAttribute)i).name);
+    result += ",\"calls\":" + to_string(profile.calls);
+    result += ",\"total_seconds\":";
+    append_number(result, (double)profile.nanoseconds / 1e9);
+    result += ",\"mean_us\":";
+    append_number(result,
+                  (double)profile.nanoseconds / (double)profile.calls / 1e3);
+    result += ",\"p50_us\":";
+    append_number(result, percentile(profile, 0.5) / 1e3);
+    result += ",\"p90_us\":";
+    append_number(result, percentile(profile, 0.9) / 1e3);
+    result += ",\"p99_us\":";
+    append_number(result, percentile(profile, 0.99) / 1e3);
+    result += ",\"max_us\":";
+    append_number(result, (double)profile.slowest / 1e3);
+    result += '}';
+  }
+  result += "]}\n";
+
+  if (path == "-") {
+    cerr << result;
+    return;
+  }
+  ofstream out(path);
+  out << result;
+  if (!out) {
+    cerr << "could not write the profile to " << path << endl;
+  }
+}
@@ -0,0 +1,57 @@
+//profiler.h
+#pragma once
+
+#include "cxcursor_info.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ * See profiler.cc for more detailed commentary
+ */
+
+enum class ProfilePhase : unsigned { Parse, Traverse, Format, Write };
+constexpr std::size_t profile_phase_count = 4;
+
+extern bool profiling_enabled;
+
+std::uint64_t profile_clock(void);
+void profile_attribute(CursorAttribute attribute, std::uint64_t nanoseconds);
+void profile_phase(ProfilePhase phase, std::uint64_t nanoseconds);
+void profile_cursor(void);
+
+/*
+ * Adds the time until it goes out of scope to a phase.
+ */
+class PhaseTimer {
+public:
+  explicit PhaseTimer(ProfilePhase p)
+      : phase(p), start(profiling_enabled ? profile_clock() : 0) {}
+  ~PhaseTimer() {
+    if (profiling_enabled) {
+      profile_phase(phase, profile_clock() - start);
+    }
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  ProfilePhase phase;
+  std::uint64_t start;
+};
+
+/*
+ * Turns profiling on for its lifetime when given a path, and writes the report
+ * there (or to stderr, for -) when it goes.
+ */
+class ProfileReport {
+public:
+  explicit ProfileReport(const std::string &path);
+  ~ProfileReport();
+  ProfileReport(const ProfileReport &) = delete;
+  ProfileReport &operator=(const ProfileReport &) = delete;
+
+private:
+  std::string path;
+  std::uint64_t start;
+};
@@ -0,0 +1,780 @@
+// project_mode.cc
+
+#include "project_mode.h"
+#include "columnar_dump.h"
+#include "cxcursor_info.h"
+#include "index_backend.h"
+#include "job_scheduler.h"
+#include "manifest.h"
+#include "mem_stats.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+#include "symbol_index.h"
+#include "tu_cache.h"
+
+#include "clang-c/CXCompilationDatabase.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <unistd.h>
+
+/* Project mode reads a compilation database (compile_commands.json) and dumps
+ * every translation unit in it.  The work is spread over a handful of worker
+ * threads, each of which owns its own CXIndex, since libclang is happy to be
+ * used from several threads as long as they don't share an index.  Each worker
+ * writes into a private buffer, and the main thread prints the buffers in
+ * database order, so the output is the same no matter how many jobs were used
+ * or how the scheduling went (longest first, see job_scheduler.cc).
+ *
+ * Text and NDJSON dumps go through a pipeline instead, so libclang never waits
+ * for the output.  Each worker still parses, walks and disposes of its
+ * translation units with its own CXIndex, but only asks libclang for the
+ * attribute values, copied out of the translation unit (see
+ * collect_cursor_records), and passes them on in batches, through a bounded
+ * queue, to a thread that formats them; and the main thread writes the result
+ * out in database order as before.  Nothing past the workers touches libclang,
+ * and a full queue holds up the workers.  Binary columns, symbol indexes and
+ * the indexer backend still format on the worker as well.
+ *
+ * Every translation unit is disposed of as soon as it has been dumped, but the
+ * buffers of the ones finished ahead of their turn, and the symbol index being
+ * built, grow with the project.  --memory-budget caps them: a finished
+ * translation unit whose output would take the waiting total over the budget
+ * writes it to a temporary file instead, which the main thread copies out
+ * when its turn comes, and the symbol tables are written out as partial
+ * indexes whenever they pass the budget and merged at the end.  Binary
+ * columns, the -U table of USRs and the -D set of declarations are still kept
+ * in memory, as they are needed whole.
+ * */
+
+using namespace std;
+
+/*
+ * -p may name either the build directory or the compile_commands.json inside
+ * it, libclang only wants the directory.
+ */
+static string database_directory(const string &path) {
+  const string database_name = "compile_commands.json";
+  if (path.size() >= database_name.size() &&
+      path.compare(path.size() - database_name.size(), string::npos,
+                   database_name) == 0) {
+    string directory = path.substr(0, path.size() - database_name.size());
+    return directory.empty() ? "." : directory;
+  }
+  return path;
+}
+
+bool load_compile_jobs(const string &build_directory,
+                       vector<CompileJob> &jobs) {
+  CXCompilationDatabase_Error error;
+  CXCompilationDatabase database = clang_CompilationDatabase_fromDirectory(
+      database_directory(build_directory).c_str(), &error);
+  if (error != CXCompilationDatabase_NoError) {
+    return false;
+  }
+  CXCompileCommands commands =
+      clang_CompilationDatabase_getAllCompileCommands(database);
+  unsigned size = clang_CompileCommands_getSize(commands);
+  jobs.reserve(size);
+  for (unsigned i = 0; i < size; ++i) {
+    CXCompileCommand command = clang_CompileCommands_getCommand(commands, i);
+    CompileJob job;
+    job.directory =
+        convert_cxstring(clang_CompileCommand_getDirectory(command));
+    job.filename = convert_cxstring(clang_CompileCommand_getFilename(command));
+    if (!job.filename.empty() && job.filename[0] != '/') {
+      job.filename = job.directory + "/" + job.filename;
+    }
+    // the first argument is the compiler itself, clang doesn't want it
+    unsigned num_args = clang_CompileCommand_getNumArgs(command);
+    for (unsigned arg = 1; arg < num_args; ++arg) {
+      job.args.push_back(
+          convert_cxstring(clang_CompileCommand_getArg(command, arg)));
+    }
+    jobs.push_back(std::move(job));
+  }
+  clang_CompileCommands_dispose(commands);
+  clang_CompilationDatabase_dispose(database);
+  return true;
+}
+
+/*
+ * The recorded arguments still name the source file (along with -c and -o,
+ * which libclang ignores), so no source filename is passed separately.
+ * Relative include paths are resolved against the recorded directory with
+ * -working-directory rather than chdir, which would affect every thread.
+ */
+static vector<const char *> compile_job_args(const CompileJob &job) {
+  vector<const char *> args;
+  args.reserve(job.args.size() + 2);
+  args.push_back("-working-directory");
+  args.push_back(job.directory.c_str());
+  for (auto &&arg : job.args) {
+    args.push_back(arg.c_str());
+  }
+  return args;
+}
+
+CXTranslationUnit parse_compile_job(CXIndex index, const CompileJob &job,
+                                    const Options &options) {
+  return parse_translation_unit(index, job.filename, job.directory,
+                                compile_job_args(job), options);
+}
+
+/*
+ * A finished translation unit waiting for the main thread to print it.
+ */
+struct ProjectResult {
+  bool done = false;
+  bool timed = false;
+  JobTimes times = {0, 0};
+  TUMemory memory;
+  string output;
+  string spill;
+  unique_ptr<ColumnarDump> columns;
+  unique_ptr<SymbolIndexBuilder> symbols;
+};
+
+struct ProjectState {
+  const Options &options;
+  const vector<CompileJob> &jobs;
+  JobScheduler scheduler;
+  vector<ProjectResult> results;
+  mutex results_mutex;
+  condition_variable results_ready;
+
+  Manifest *manifest;
+  atomic<size_t> reused;
+  atomic<size_t> pending;
+
+  ProjectState(const Options &o, const vector<CompileJob> &j,
+               const vector<double> &costs, size_t workers, Manifest *m)
+      : options(o), jobs(j), scheduler(costs, workers), results(j.size()),
+        manifest(m), reused(0), pending(0) {}
+};
+
+static double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void append_job_header(string &result, const CompileJob &job,
+                              const Options &options, bool parsed) {
+  if (options.format == OutputFormat::NDJSON) {
+    result += "{\"translation_unit\":";
+    append_json_string(result, job.filename.c_str());
+    result += parsed ? "}\n" : ",\"error\":\"failed to parse\"}\n";
+    return;
+  }
+  result += "translation unit: " + job.filename + '\n';
+  if (!parsed) {
+    result += "failed to parse " + job.filename + '\n';
+  }
+}
+
+/*
+ * The indexer backend, session is the worker's CXIndexAction with -B session
+ * and null otherwise.
+ */
+static void index_compile_job(CXIndex index, CXIndexAction session,
+                              const CompileJob &job, const Options &options,
+                              Manifest *manifest, ProjectResult &result) {
+  CXIndexAction action =
+      session != nullptr ? session : clang_IndexAction_create(index);
+  IndexTarget target{nullptr, nullptr, nullptr};
+  OutputSink out;
+  if (!options.index_output.empty()) {
+    result.symbols.reset(new SymbolIndexBuilder);
+    result.symbols->begin_translation_unit(job.directory);
+    target.symbols = result.symbols.get();
+  } else if (options.format == OutputFormat::Binary) {
+    result.columns.reset(new ColumnarDump(options.resolved_attributes));
+    result.columns->begin_translation_unit(job.filename);
+    target.columns = result.columns.get();
+  } else {
+    target.out = &out;
+  }
+  CXTranslationUnit TU = nullptr;
+  bool keep_TU = manifest != nullptr || memory_stats_enabled;
+  // the indexer parses and reports as it goes, so it all counts as parsing
+  auto start = chrono::steady_clock::now();
+  bool indexed = index_source(action, job.filename, compile_job_args(job),
+                              options, target, keep_TU ? &TU : nullptr);
+  result.times.parse = seconds_since(start);
+  result.timed = true;
+  if (TU != nullptr) {
+    if (indexed && manifest != nullptr) {
+      manifest->record(job, TU);
+    }
+    if (memory_stats_enabled) {
+      measure_parse(result.memory, TU);
+      measure_traversal(result.memory);
+    }
+    clang_disposeTranslationUnit(TU);
+  }
+  if (target.out != nullptr) {
+    append_job_header(result.output, job, options, indexed);
+    result.output += out.buffer();
+  }
+  if (session == nullptr) {
+    clang_IndexAction_dispose(action);
+  }
+}
+
+static void dump_compile_job(CXIndex index, CXIndexAction session,
+                             const CompileJob &job, const Options &options,
+                             Manifest *manifest, ProjectResult &result) {
+  if (options.backend != Backend::Visit) {
+    index_compile_job(index, session, job, options, manifest, result);
+    return;
+  }
+  auto start = chrono::steady_clock::now();
+  CXTranslationUnit TU = parse_compile_job(index, job, options);
+  result.times.parse = seconds_since(start);
+  result.timed = true;
+  start = chrono::steady_clock::now();
+  if (TU != nullptr && manifest != nullptr) {
+    manifest->record(job, TU);
+  }
+  if (TU != nullptr && memory_stats_enabled) {
+    measure_parse(result.memory, TU);
+  }
+  if (!options.index_output.empty()) {
+    if (TU == nullptr) {
+      cerr << "failed to parse " << job.filename << endl;
+      return;
+    }
+    result.symbols.reset(new SymbolIndexBuilder);
+    result.symbols->add_translation_unit(TU, job.directory);
+    dispose_translation_unit(TU);
+    result.times.traverse = seconds_since(start);
+    return;
+  }
+  if (options.format == OutputFormat::Binary) {
+    result.columns.reset(new ColumnarDump(options.resolved_attributes));
+    result.columns->begin_translation_unit(job.filename);
+    if (TU == nullptr) {
+      cerr << "failed to parse " << job.filename << endl;
+      return;
+    }
+  } else {
+    append_job_header(result.output, job, options, TU != nullptr);
+    if (TU == nullptr) {
+      return;
+    }
+  }
+  reset_id_table();
+  CXCursor cursor = clang_getTranslationUnitCursor(TU);
+  if (result.columns) {
+    dump_cursor_tree(cursor, options, *result.columns);
+  } else {
+    OutputSink out;
+    out.buffer().swap(result.output);
+    dump_cursor_tree(cursor, options, out);
+    out.buffer().swap(result.output);
+  }
+  if (memory_stats_enabled) {
+    measure_traversal(result.memory);
+  }
+  dispose_translation_unit(TU);
+  result.times.traverse = seconds_since(start);
+}
+
+/*
+ * With -n, the output of an unchanged translation unit is read back from its
+ * fragment instead.
+ */
+static bool reuse_fragment(Manifest &manifest, const CompileJob &job,
+                           const Options &options, ProjectResult &result) {
+  if (!manifest.up_to_date(job)) {
+    return false;
+  }
+  string path = manifest.fragment_path(job);
+  if (!options.index_output.empty()) {
+    SymbolIndex index;
+    if (!index.open(path)) {
+      return false;
+    }
+    result.symbols.reset(new SymbolIndexBuilder);
+    result.symbols->add_index(index);
+    return true;
+  }
+  if (options.format == OutputFormat::Binary) {
+    ColumnarFile file;
+    if (!file.open(path)) {
+      return false;
+    }
+    result.columns.reset(new ColumnarDump(options.resolved_attributes));
+    return result.columns->append(file);
+  }
+  ifstream in(path, ios::binary);
+  if (!in) {
+    return false;
+  }
+  result.output.assign(istreambuf_iterator<char>(in),
+                       istreambuf_iterator<char>());
+  return true;
+}
+
+static void store_fragment(const string &path, const Options &options,
+                           ProjectResult &result) {
+  string temporary =
+      path + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+  bool written;
+  {
+    OutputSink out;
+    if (!out.open(temporary)) {
+      return;
+    }
+    if (!options.index_output.empty()) {
+      if (!result.symbols) {
+        return;
+      }
+      result.symbols->write(out);
+    } else if (options.format == OutputFormat::Binary) {
+      if (!result.columns) {
+        return;
+      }
+      result.columns->write(out);
+    } else {
+      out.append(result.output);
+    }
+    written = out.flush();
+  }
+  if (written) {
+    rename(temporary.c_str(), path.c_str());
+  } else {
+    remove(temporary.c_str());
+  }
+}
+
+/*
+ * An empty, private file for whatever doesn't fit in --memory-budget.
+ */
+static string temporary_file() {
+  const char *directory = getenv("TMPDIR");
+  string path = string(directory != nullptr ? directory : "/tmp") +
+                "/cxcursor_info.XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    return string();
+  }
+  close(fd);
+  return path;
+}
+
+static bool spill_output(ProjectResult &result) {
+  string path = temporary_file();
+  if (path.empty()) {
+    return false;
+  }
+  OutputSink out;
+  if (!out.open(path)) {
+    remove(path.c_str());
+    return false;
+  }
+  out.append(result.output);
+  if (!out.flush()) {
+    remove(path.c_str());
+    return false;
+  }
+  string().swap(result.output);
+  result.spill = path;
+  return true;
+}
+
+static void copy_spilled_output(const string &path, OutputSink &out) {
+  ifstream in(path, ios::binary);
+  char chunk[1 << 16];
+  while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0) {
+    out.buffer().append(chunk, (size_t)in.gcount());
+    out.record_done();
+  }
+  remove(path.c_str());
+}
+
+static void spill_symbols(SymbolIndexBuilder &symbols,
+                          vector<string> &partial_indexes) {
+  string path = temporary_file();
+  OutputSink out;
+  if (path.empty() || !out.open(path)) {
+    cerr << "could not spill the symbol index, keeping it in memory" << endl;
+    return;
+  }
+  symbols.write(out);
+  out.flush();
+  symbols.clear();
+  partial_indexes.push_back(path);
+}
+
+/*
+ * Hands a finished translation unit over to the main thread.
+ */
+static void finish_job(ProjectState *state, size_t i, ProjectResult &result) {
+  if (memory_stats_enabled && result.timed) {
+    result.memory.file = state->jobs[i].filename;
+    result.memory.output_bytes = result.output.size();
+    report_memory(result.memory);
+  }
+  size_t budget = state->options.memory_budget;
+  size_t size = result.output.size();
+  if (state->pending.fetch_add(size) + size > budget && budget != 0 &&
+      spill_output(result)) {
+    state->pending -= size;
+  }
+  {
+    lock_guard<mutex> lock(state->results_mutex);
+    state->results[i].output = std::move(result.output);
+    state->results[i].spill = std::move(result.spill);
+    state->results[i].timed = result.timed;
+    state->results[i].times = result.times;
+    state->results[i].columns = std::move(result.columns);
+    state->results[i].symbols = std::move(result.symbols);
+    state->results[i].done = true;
+  }
+  state->results_ready.notify_all();
+}
+
+static void project_worker(ProjectState *state, size_t worker) {
+  CXIndex index = clang_createIndex(0, 0);
+  CXIndexAction session = nullptr;
+  if (state->options.backend == Backend::IndexSession) {
+    session = clang_IndexAction_create(index);
+  }
+  size_t i;
+  while (state->scheduler.next(worker, i)) {
+    ProjectResult result;
+    const CompileJob &job = state->jobs[i];
+    Manifest *manifest = state->manifest;
+    if (manifest != nullptr &&
+        reuse_fragment(*manifest, job, state->options, result)) {
+      ++state->reused;
+    } else {
+      dump_compile_job(index, session, job, state->options, manifest, result);
+      if (manifest != nullptr) {
+        store_fragment(manifest->fragment_path(job), state->options, result);
+      }
+    }
+    if (state->options.memory_budget != 0) {
+      release_id_table();
+    }
+    finish_job(state, i, result);
+  }
+  if (session != nullptr) {
+    clang_IndexAction_dispose(session);
+  }
+  clang_disposeIndex(index);
+}
+
+/*
+ * A bounded queue between two stages of the pipeline.  push waits while the
+ * queue is full, and pop waits for an item until the queue is closed.  Items
+ * are whole translation units or batches of records, so there are few enough
+ * of them that a mutex costs nothing worth measuring.
+ */
+template <typename T> class StageQueue {
+public:
+  explicit StageQueue(size_t c) : capacity(c), closed(false) {}
+
+  void push(T item) {
+    unique_lock<mutex> guard(lock);
+    not_full.wait(guard, [&] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    guard.unlock();
+    not_empty.notify_one();
+  }
+
+  bool pop(T &item) {
+    unique_lock<mutex> guard(lock);
+    not_empty.wait(guard, [&] { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    guard.unlock();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    {
+      lock_guard<mutex> guard(lock);
+      closed = true;
+    }
+    not_empty.notify_all();
+  }
+
+private:
+  size_t capacity;
+  bool closed;
+  mutex lock;
+  condition_variable not_full;
+  condition_variable not_empty;
+  deque<T> items;
+};
+
+/*
+ * The last batch of a translation unit carries its times and memory use.
+ */
+struct RecordBatch {
+  size_t job = 0;
+  bool first = false;
+  bool last = false;
+  RawRecords records;
+  JobTimes times = {0, 0};
+  TUMemory memory;
+};
+
+static const size_t records_per_batch = 1024;
+
+struct Pipeline {
+  StageQueue<RecordBatch> batches;
+  atomic<size_t> collectors;
+
+  explicit Pipeline(size_t workers)
+      : batches(workers * 4), collectors(workers) {}
+};
+
+static bool pipelined(const Options &options) {
+  return options.backend == Backend::Visit && options.index_output.empty() &&
+         options.format != OutputFormat::Binary;
+}
+
+/*
+ * The collecting end of the pipeline, one per worker.  The worker's index and
+ * its translation units never leave this thread: only detached values go on
+ * to the formatting thread.
+ */
+static void collect_stage(ProjectState *state, Pipeline *pipeline,
+                          size_t worker) {
+  const Options &options = state->options;
+  CXIndex index = clang_createIndex(0, 0);
+  size_t i;
+  while (state->scheduler.next(worker, i)) {
+    ProjectResult result;
+    const CompileJob &job = state->jobs[i];
+    Manifest *manifest = state->manifest;
+    if (manifest != nullptr &&
+        reuse_fragment(*manifest, job, options, result)) {
+      ++state->reused;
+      finish_job(state, i, result);
+      continue;
+    }
+    auto start = chrono::steady_clock::now();
+    CXTranslationUnit TU = parse_compile_job(index, job, options);
+    result.times.parse = seconds_since(start);
+    result.timed = true;
+    if (TU == nullptr) {
+      append_job_header(result.output, job, options, false);
+      if (manifest != nullptr) {
+        store_fragment(manifest->fragment_path(job), options, result);
+      }
+      finish_job(state, i, result);
+      continue;
+    }
+    if (manifest != nullptr) {
+      manifest->record(job, TU);
+    }
+    if (memory_stats_enabled) {
+      measure_parse(result.memory, TU);
+    }
+    start = chrono::steady_clock::now();
+    bool first = true;
+    reset_id_table();
+    collect_cursor_records(clang_getTranslationUnitCursor(TU), options,
+                           records_per_batch, [&](RawRecords &records) {
+                             RecordBatch batch;
+                             batch.job = i;
+                             batch.first = first;
+                             batch.records = std::move(records);
+                             pipeline->batches.push(std::move(batch));
+                             first = false;
+                           });
+    if (memory_stats_enabled) {
+      measure_traversal(result.memory);
+    }
+    dispose_translation_unit(TU);
+    if (options.memory_budget != 0) {
+      release_id_table();
+    }
+    RecordBatch last;
+    last.job = i;
+    last.first = first;
+    last.last = true;
+    last.times = result.times;
+    last.times.traverse = seconds_since(start);
+    last.memory = std::move(result.memory);
+    pipeline->batches.push(std::move(last));
+  }
+  clang_disposeIndex(index);
+  if (--pipeline->collectors == 0) {
+    pipeline->batches.close();
+  }
+}
+
+/*
+ * The batches of a translation unit arrive in order, since one worker pushes
+ * them all; those of different translation units interleave.
+ */
+static void format_stage(ProjectState *state, Pipeline *pipeline) {
+  const Options &options = state->options;
+  unordered_map<size_t, ProjectResult> unfinished;
+  RecordBatch batch;
+  while (pipeline->batches.pop(batch)) {
+    const CompileJob &job = state->jobs[batch.job];
+    ProjectResult &result = unfinished[batch.job];
+    if (batch.first) {
+      append_job_header(result.output, job, options, true);
+    }
+    append_raw_records(result.output, batch.records, options);
+    if (!batch.last) {
+      continue;
+    }
+    result.timed = true;
+    result.times = batch.times;
+    result.memory = std::move(batch.memory);
+    if (state->manifest != nullptr) {
+      store_fragment(state->manifest->fragment_path(job), options, result);
+    }
+    finish_job(state, batch.job, result);
+    unfinished.erase(batch.job);
+  }
+}
+
+int run_project(const Options &options, const vector<CompileJob> &jobs,
+                OutputSink &out) {
+  size_t num_threads = options.jobs;
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+  if (num_threads > jobs.size()) {
+    num_threads = jobs.size();
+  }
+
+  unique_ptr<Manifest> manifest;
+  if (!options.incremental.empty()) {
+    if (options.dedup || options.usr_ids) {
+      cerr << "-n can't be combined with -D or -U" << endl;
+      return 1;
+    }
+    manifest.reset(new Manifest(options.incremental, options));
+    if (!manifest->load()) {
+      cerr << "ignoring the unreadable manifest in " << options.incremental
+           << endl;
+      manifest.reset(new Manifest(options.incremental, options));
+    }
+  }
+
+  JobHistory history(options.history);
+  if (!options.history.empty() && !history.load()) {
+    cerr << "ignoring the unreadable history " << options.history << endl;
+    history = JobHistory(options.history);
+  }
+  ProjectState state(options, jobs, history.estimate(jobs), num_threads,
+                     manifest.get());
+  vector<thread> workers;
+  unique_ptr<Pipeline> pipeline;
+  if (pipelined(options)) {
+    pipeline.reset(new Pipeline(num_threads));
+    for (size_t i = 0; i < num_threads; ++i) {
+      workers.emplace_back(collect_stage, &state, pipeline.get(), i);
+    }
+    workers.emplace_back(format_stage, &state, pipeline.get());
+    if (num_threads == 0) {
+      pipeline->batches.close();
+    }
+  } else {
+    for (size_t i = 0; i < num_threads; ++i) {
+      workers.emplace_back(project_worker, &state, i);
+    }
+  }
+
+  // print in database order as soon as the next translation unit is ready,
+  // binary dumps are merged into one set of columns and written at the end
+  ColumnarDump columns(options.resolved_attributes);
+  SymbolIndexBuilder symbols;
+  vector<string> partial_indexes;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    string output;
+    string spill;
+    unique_ptr<ColumnarDump> job_columns;
+    unique_ptr<SymbolIndexBuilder> job_symbols;
+    {
+      unique_lock<mutex> lock(state.results_mutex);
+      state.results_ready.wait(lock, [&] { return state.results[i].done; });
+      output.swap(state.results[i].output);
+      spill.swap(state.results[i].spill);
+      if (state.results[i].timed) {
+        history.record(jobs[i].filename, state.results[i].times);
+      }
+      job_columns = std::move(state.results[i].columns);
+      job_symbols = std::move(state.results[i].symbols);
+    }
+    if (job_columns) {
+      columns.append(*job_columns);
+    }
+    if (job_symbols) {
+      symbols.merge(*job_symbols);
+      if (options.memory_budget != 0 &&
+          symbols.memory() > options.memory_budget) {
+        spill_symbols(symbols, partial_indexes);
+      }
+    }
+    state.pending -= output.size();
+    out.append(output);
+    out.record_done();
+    if (!spill.empty()) {
+      copy_spilled_output(spill, out);
+    }
+  }
+  if (!options.index_output.empty()) {
+    OutputSink index_out;
+    if (!index_out.open(options.index_output)) {
+      cerr << "could not open " << options.index_output << endl;
+    } else if (partial_indexes.empty()) {
+      symbols.write(index_out);
+    } else {
+      if (symbols.size() > 0) {
+        spill_symbols(symbols, partial_indexes);
+      }
+      merge_symbol_indexes(partial_indexes, index_out);
+    }
+    for (auto &&path : partial_indexes) {
+      remove(path.c_str());
+    }
+  } else if (options.format == OutputFormat::Binary) {
+    columns.write(out);
+  }
+  out.flush();
+
+  for (auto &&worker : workers) {
+    worker.join();
+  }
+  if (!options.history.empty() && !history.save()) {
+    cerr << "could not write the history " << options.history << endl;
+  }
+  if (manifest) {
+    if (!manifest->save(jobs)) {
+      cerr << "could not write the manifest in " << options.incremental
+           << endl;
+    }
+    cerr << "reused " << state.reused << " of " << jobs.size()
+         << " translation units" << endl;
+  }
+  return 0;
+}
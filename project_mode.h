@@ -0,0 +1,27 @@
+//project_mode.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <string>
+#include <vector>
+
+struct Options;
+class OutputSink;
+
+/*
+ * See project_mode.cc for more detailed commentary
+ */
+
+struct CompileJob {
+  std::string directory;
+  std::string filename;
+  std::vector<std::string> args;
+};
+
+bool load_compile_jobs(const std::string &build_directory,
+                       std::vector<CompileJob> &jobs);
+CXTranslationUnit parse_compile_job(CXIndex index, const CompileJob &job,
+                                    const Options &options);
+int run_project(const Options &options, const std::vector<CompileJob> &jobs,
+                OutputSink &out);
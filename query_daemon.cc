@@ -0,0 +1,439 @@
+// query_daemon.cc
+
+#include "query_daemon.h"
+#include "cxcursor_info.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+#include "tu_cache.h"
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* The daemon (--serve socket) keeps parsed translation units in memory and
+ * answers queries from any number of clients over a Unix domain socket, so a
+ * query only costs the traversal.  The main thread polls every connection,
+ * and hands one that has something to read to a pool of -j worker threads,
+ * which answer the requests it holds and give it back.  So an idle client
+ * costs nothing but its descriptor, however many of them are connected.
+ *
+ * Requests are single lines, and every reply ends with a line holding just
+ * "end", as in session mode:
+ *
+ *   at file line col [attribute...]   the cursor at a location (and below
+ *                                     it, with -r or -d)
+ *   dump file [attribute...]          the whole translation unit (down to
+ *                                     -d levels)
+ *   forget file                       drop the translation unit
+ *   quit                              close the connection
+ *
+ * Attributes are named as in attribute_table (CursorSpelling, isVirtual...),
+ * and default to the ones chosen on the command line.  Up to --max-tus
+ * translation units are kept, the least recently used one is dropped to make
+ * room.  A translation unit is reparsed when its file, or any file it
+ * included, changed on disk since it was parsed.  When the daemon was given a
+ * project (-p), files are parsed with their flags from compile_commands.json.
+ * */
+
+using namespace std;
+
+/*
+ * libclang doesn't let two threads use one translation unit at the same time,
+ * so each one comes with its own lock.  Whoever drops the last reference
+ * disposes of it, which may be a query still running after an eviction.
+ */
+struct LoadedTU {
+  mutex lock;
+  CXIndex index;
+  CXTranslationUnit TU;
+  // the file and everything it included, with their modification times
+  vector<pair<string, time_t>> files;
+
+  LoadedTU() : index(clang_createIndex(0, 0)), TU(nullptr) {}
+  ~LoadedTU() {
+    if (TU != nullptr) {
+      dispose_translation_unit(TU);
+    }
+    clang_disposeIndex(index);
+  }
+};
+
+static time_t modification_time(const string &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return 0;
+  }
+  return info.st_mtime;
+}
+
+static bool files_changed(const vector<pair<string, time_t>> &files) {
+  for (auto &&file : files) {
+    if (modification_time(file.first) != file.second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+class TUCache {
+public:
+  TUCache(const Options &o, const vector<CompileJob> &jobs)
+      : options(o), max_size(o.max_tus == 0 ? 1 : o.max_tus) {
+    for (auto &&job : jobs) {
+      compile_jobs.emplace(job.filename, &job);
+    }
+  }
+
+  shared_ptr<LoadedTU> get(const string &path) {
+    shared_ptr<LoadedTU> loaded;
+    {
+      lock_guard<mutex> guard(cache_lock);
+      auto it = entries.find(path);
+      if (it != entries.end()) {
+        recently_used.splice(recently_used.begin(), recently_used,
+                             it->second.position);
+        loaded = it->second.loaded;
+      } else {
+        loaded = make_shared<LoadedTU>();
+        recently_used.push_front(path);
+        entries[path] = Entry{loaded, recently_used.begin()};
+        while (entries.size() > max_size) {
+          entries.erase(recently_used.back());
+          recently_used.pop_back();
+        }
+      }
+    }
+    // parse outside the cache lock, so other files can be served meanwhile
+    lock_guard<mutex> guard(loaded->lock);
+    if (loaded->TU != nullptr && !files_changed(loaded->files)) {
+      return loaded;
+    }
+    time_t modified = modification_time(path);
+    if (loaded->TU != nullptr &&
+        clang_reparseTranslationUnit(
+            loaded->TU, 0, nullptr,
+            clang_defaultReparseOptions(loaded->TU)) != 0) {
+      dispose_translation_unit(loaded->TU);
+      loaded->TU = nullptr;
+    }
+    if (loaded->TU == nullptr) {
+      loaded->TU = parse(loaded->index, path);
+    }
+    loaded->files.clear();
+    if (loaded->TU != nullptr) {
+      loaded->files.emplace_back(path, modified);
+      for (auto &&include : included_files(loaded->TU, directory(path))) {
+        loaded->files.emplace_back(include, modification_time(include));
+      }
+    }
+    return loaded;
+  }
+
+  void forget(const string &path) {
+    lock_guard<mutex> guard(cache_lock);
+    auto it = entries.find(path);
+    if (it != entries.end()) {
+      recently_used.erase(it->second.position);
+      entries.erase(it);
+    }
+  }
+
+private:
+  struct Entry {
+    shared_ptr<LoadedTU> loaded;
+    list<string>::iterator position;
+  };
+  const Options &options;
+  size_t max_size;
+  mutex cache_lock;
+  map<string, Entry> entries;
+  list<string> recently_used;
+  map<string, const CompileJob *> compile_jobs;
+
+  string directory(const string &path) const {
+    auto job = compile_jobs.find(path);
+    return job != compile_jobs.end() ? job->second->directory : "";
+  }
+
+  CXTranslationUnit parse(CXIndex index, const string &path) {
+    auto job = compile_jobs.find(path);
+    if (job != compile_jobs.end()) {
+      return parse_compile_job(index, *job->second, options);
+    }
+    vector<const char *> args{path.c_str()};
+    return parse_translation_unit(index, path, "", args, options);
+  }
+};
+
+/*
+ * Anything after the fixed arguments of a request names attributes.
+ */
+static bool request_options(const Options &defaults, istream &request,
+                            Options &options, string &error) {
+  options = defaults;
+  string name;
+  bool custom = false;
+  while (request >> name) {
+    CursorAttribute attribute;
+    if (!find_attribute(name, attribute)) {
+      error = "unknown attribute: " + name;
+      return false;
+    }
+    if (!custom) {
+      options.resolved_attributes.clear();
+      custom = true;
+    }
+    options.resolved_attributes.push_back(attribute);
+  }
+  return true;
+}
+
+static void answer(const Options &defaults, TUCache &cache,
+                   const string &line, OutputSink &out) {
+  istringstream request(line);
+  string command;
+  string file;
+  request >> command >> file;
+  string &result = out.buffer();
+  if (command == "forget") {
+    cache.forget(file);
+    return;
+  }
+  if (command != "at" && command != "dump") {
+    result += "unknown command: " + command + "\n";
+    return;
+  }
+  unsigned line_number = 0;
+  unsigned col = 0;
+  if (command == "at" && !(request >> line_number >> col)) {
+    result += "expected: at file line col [attribute...]\n";
+    return;
+  }
+  Options options;
+  string error;
+  if (!request_options(defaults, request, options, error)) {
+    result += error + "\n";
+    return;
+  }
+
+  shared_ptr<LoadedTU> loaded = cache.get(file);
+  lock_guard<mutex> guard(loaded->lock);
+  if (loaded->TU == nullptr) {
+    result += "failed to parse " + file + "\n";
+    return;
+  }
+  reset_id_table();
+  CXCursor cursor;
+  if (command == "dump") {
+    options.recurse = true;
+    cursor = clang_getTranslationUnitCursor(loaded->TU);
+  } else {
+    CXFile cxfile = clang_getFile(loaded->TU, file.c_str());
+    if (cxfile == nullptr) {
+      result += "no such file in translation unit: " + file + "\n";
+      return;
+    }
+    cursor = clang_getCursor(
+        loaded->TU, clang_getLocation(loaded->TU, cxfile, line_number, col));
+  }
+  dump_cursor_tree(cursor, options, out);
+}
+
+/*
+ * A connection, with whatever it sent past the last complete request.
+ */
+struct Client {
+  int fd;
+  string pending;
+};
+
+/*
+ * Reads what the client sent, which poll said is there, and answers every
+ * complete request in it.  Returns false once the connection is done with.
+ */
+static bool serve_client(const Options &options, TUCache &cache,
+                         Client &client) {
+  char buffer[4096];
+  ssize_t size = read(client.fd, buffer, sizeof(buffer));
+  if (size < 0 && (errno == EINTR || errno == EAGAIN)) {
+    return true;
+  }
+  if (size <= 0) {
+    return false;
+  }
+  client.pending.append(buffer, (size_t)size);
+  OutputSink out(client.fd);
+  size_t newline;
+  while ((newline = client.pending.find('\n')) != string::npos) {
+    string line = client.pending.substr(0, newline);
+    client.pending.erase(0, newline + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line == "quit") {
+      return false;
+    }
+    if (line.empty()) {
+      continue;
+    }
+    answer(options, cache, line, out);
+    out.buffer() += "end\n";
+    if (!out.flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Connections go from the poll loop to the workers through ready, and back
+ * through idle, writing to wake so the loop notices.
+ */
+struct ClientQueue {
+  mutex lock;
+  condition_variable ready_changed;
+  deque<unique_ptr<Client>> ready;
+  vector<unique_ptr<Client>> idle;
+  int wake[2];
+};
+
+static void daemon_worker(const Options *options, TUCache *cache,
+                          ClientQueue *queue) {
+  for (;;) {
+    unique_ptr<Client> client;
+    {
+      unique_lock<mutex> guard(queue->lock);
+      queue->ready_changed.wait(guard, [&] { return !queue->ready.empty(); });
+      client = std::move(queue->ready.front());
+      queue->ready.pop_front();
+    }
+    if (!serve_client(*options, *cache, *client)) {
+      close(client->fd);
+      continue;
+    }
+    {
+      lock_guard<mutex> guard(queue->lock);
+      queue->idle.push_back(std::move(client));
+    }
+    char byte = 0;
+    while (write(queue->wake[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+int run_daemon(const Options &options, const vector<CompileJob> &jobs) {
+  // a client hanging up mid reply shouldn't take the daemon down
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (options.socket_path.size() >= sizeof(address.sun_path)) {
+    cerr << "socket path too long: " << options.socket_path << endl;
+    return 1;
+  }
+  strcpy(address.sun_path, options.socket_path.c_str());
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(options.socket_path.c_str());
+  if (listener < 0 ||
+      ::bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, 64) != 0) {
+    cerr << "could not listen on " << options.socket_path << endl;
+    return 1;
+  }
+
+  size_t num_threads = options.jobs;
+  if (num_threads == 0) {
+    num_threads = thread::hardware_concurrency();
+  }
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+
+  TUCache cache(options, jobs);
+  ClientQueue queue;
+  if (pipe(queue.wake) != 0) {
+    cerr << "could not create the wake up pipe" << endl;
+    return 1;
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    thread(daemon_worker, &options, &cache, &queue).detach();
+  }
+  cerr << "serving on " << options.socket_path << " with " << num_threads
+       << " workers" << endl;
+
+  // the connections waiting for a request, polled after the listener and
+  // the wake up pipe
+  vector<unique_ptr<Client>> waiting;
+  vector<pollfd> polled;
+  for (;;) {
+    polled.clear();
+    polled.push_back(pollfd{listener, POLLIN, 0});
+    polled.push_back(pollfd{queue.wake[0], POLLIN, 0});
+    for (auto &&client : waiting) {
+      polled.push_back(pollfd{client->fd, POLLIN, 0});
+    }
+    if (poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "poll failed" << endl;
+      break;
+    }
+    if (polled[1].revents != 0) {
+      char bytes[64];
+      while (read(queue.wake[0], bytes, sizeof(bytes)) < 0 && errno == EINTR) {
+      }
+      lock_guard<mutex> guard(queue.lock);
+      for (auto &&client : queue.idle) {
+        waiting.push_back(std::move(client));
+      }
+      queue.idle.clear();
+    }
+    // waiting only grew at its end, so polled still lines up with it
+    size_t dispatched = 0;
+    {
+      lock_guard<mutex> guard(queue.lock);
+      size_t kept = 0;
+      for (size_t i = 0; i < waiting.size(); ++i) {
+        if (i + 2 < polled.size() && polled[i + 2].revents != 0) {
+          queue.ready.push_back(std::move(waiting[i]));
+          ++dispatched;
+        } else {
+          waiting[kept++] = std::move(waiting[i]);
+        }
+      }
+      waiting.resize(kept);
+    }
+    for (size_t i = 0; i < dispatched; ++i) {
+      queue.ready_changed.notify_one();
+    }
+    if (polled[0].revents != 0) {
+      int fd = accept(listener, nullptr, nullptr);
+      if (fd >= 0) {
+        waiting.emplace_back(new Client{fd, ""});
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        cerr << "accept failed" << endl;
+        break;
+      }
+    }
+  }
+  close(listener);
+  unlink(options.socket_path.c_str());
+  return 1;
+}
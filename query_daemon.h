@@ -0,0 +1,15 @@
+//query_daemon.h
+#pragma once
+
+#include "project_mode.h"
+
+#include <string>
+#include <vector>
+
+struct Options;
+
+/*
+ * See query_daemon.cc for more detailed commentary
+ */
+
+int run_daemon(const Options &options, const std::vector<CompileJob> &jobs);
@@ -0,0 +1,7 @@
+// The declarations of extern_c.h are children of a LinkageSpec in this file,
+// so --where '!isFromMainFile' must not skip the LinkageSpec's subtree.
+extern "C" {
+#include "extern_c.h"
+}
+
+int main_file_function(void) { return from_header(1); }
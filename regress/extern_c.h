@@ -0,0 +1,4 @@
+int from_header(int x);
+struct header_struct {
+  int field;
+};
@@ -0,0 +1,172 @@
+// session_mode.cc
+
+#include "session_mode.h"
+#include "cxcursor_info.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+#include "tu_cache.h"
+
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+
+/* Session mode keeps one translation unit loaded and answers queries read
+ * from a stream (stdin, usually), so an editor can ask about location after
+ * location without paying for a parse each time.  The translation unit is
+ * parsed with a precompiled preamble, so after an edit only the part of the
+ * file after the #includes is parsed again by clang_reparseTranslationUnit.
+ *
+ * Commands, one per line:
+ *
+ *   L line col            dump the cursor at the location in the source
+ *                         (and below it, with -r or -d)
+ *   F file line col       same, for a location in any file of the TU
+ *   edit file size        the next size bytes are the new contents of file,
+ *                         which replace what's on disk until reverted
+ *   revert file           forget the edited contents of file
+ *   reparse               parse again with the current contents
+ *   quit
+ *
+ * Every reply is terminated by a line holding just "end", so the client
+ * knows when to stop reading.  Edits are only picked up on the next reparse,
+ * so a client would usually send a few edits and then reparse.
+ * */
+
+using namespace std;
+
+static const string end_of_reply = "end";
+
+/*
+ * The unsaved buffers have to outlive the translation unit, since clang keeps
+ * pointing at them, so they are owned here rather than by the command loop.
+ */
+struct Session {
+  const Options &options;
+  CXIndex index;
+  CXTranslationUnit TU;
+  map<string, string> unsaved_contents;
+  vector<CXUnsavedFile> unsaved_files;
+
+  explicit Session(const Options &o)
+      : options(o), index(clang_createIndex(0, 0)), TU(nullptr) {}
+  ~Session() {
+    if (TU != nullptr) {
+      clang_disposeTranslationUnit(TU);
+    }
+    clang_disposeIndex(index);
+  }
+
+  void update_unsaved_files() {
+    unsaved_files.clear();
+    for (auto &&file : unsaved_contents) {
+      unsaved_files.push_back(CXUnsavedFile{
+          file.first.c_str(), file.second.data(), file.second.size()});
+    }
+  }
+
+  bool parse() {
+    update_unsaved_files();
+    unsigned flags = clang_defaultEditingTranslationUnitOptions() |
+                     CXTranslationUnit_PrecompiledPreamble |
+                     CXTranslationUnit_CreatePreambleOnFirstParse;
+    if (options.parse_profile == ParseProfile::Decls) {
+      flags |= parse_flags(options);
+    }
+    TU = clang_parseTranslationUnit(
+        index, options.source.c_str(), nullptr, 0, unsaved_files.data(),
+        (unsigned)unsaved_files.size(), flags);
+    return TU != nullptr;
+  }
+
+  bool reparse() {
+    update_unsaved_files();
+    // every cursor handed out so far belongs to the old AST
+    reset_id_table();
+    if (clang_reparseTranslationUnit(TU, (unsigned)unsaved_files.size(),
+                                     unsaved_files.data(),
+                                     clang_defaultReparseOptions(TU)) != 0) {
+      // the translation unit is unusable after a failed reparse
+      clang_disposeTranslationUnit(TU);
+      TU = nullptr;
+      return parse();
+    }
+    return true;
+  }
+
+  void query(const string &file, unsigned line, unsigned col, ostream &out) {
+    CXFile cxfile = clang_getFile(TU, file.c_str());
+    if (cxfile == nullptr) {
+      out << "no such file in translation unit: " << file << '\n';
+      return;
+    }
+    CXSourceLocation location = clang_getLocation(TU, cxfile, line, col);
+    out << "cxlocation: " << string_location(location) << '\n';
+    OutputSink sink;
+    dump_cursor_tree(clang_getCursor(TU, location), options, sink);
+    out << sink.buffer();
+  }
+};
+
+int run_session(const Options &options, istream &in, ostream &out) {
+  Session session(options);
+  if (!session.parse()) {
+    out << "failed to parse " << options.source << '\n'
+        << end_of_reply << endl;
+    return 1;
+  }
+  out << "ready" << '\n' << end_of_reply << endl;
+
+  string line;
+  while (getline(in, line)) {
+    istringstream command_line(line);
+    string command;
+    command_line >> command;
+    if (command.empty()) {
+      continue;
+    } else if (command == "quit") {
+      break;
+    } else if (command == "L" || command == "F") {
+      string file = options.source;
+      unsigned line_number = 0;
+      unsigned col = 0;
+      if (command == "F") {
+        command_line >> file;
+      }
+      if (command_line >> line_number >> col) {
+        session.query(file, line_number, col, out);
+      } else {
+        out << "expected: " << command << (command == "F" ? " file" : "")
+            << " line col" << '\n';
+      }
+    } else if (command == "edit") {
+      string file;
+      size_t size = 0;
+      if (!(command_line >> file >> size)) {
+        out << "expected: edit file size" << '\n';
+      } else {
+        string contents(size, '\0');
+        in.read(&contents[0], (streamsize)size);
+        if ((size_t)in.gcount() != size) {
+          out << "short read of edit contents" << '\n';
+        } else {
+          session.unsaved_contents[file] = std::move(contents);
+        }
+      }
+    } else if (command == "revert") {
+      string file;
+      command_line >> file;
+      session.unsaved_contents.erase(file);
+    } else if (command == "reparse") {
+      if (!session.reparse()) {
+        out << "failed to parse " << options.source << '\n'
+            << end_of_reply << endl;
+        return 1;
+      }
+    } else {
+      out << "unknown command: " << command << '\n';
+    }
+    out << end_of_reply << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,13 @@
+//session_mode.h
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+struct Options;
+
+/*
+ * See session_mode.cc for more detailed commentary
+ */
+
+int run_session(const Options &options, std::istream &in, std::ostream &out);
@@ -0,0 +1,220 @@
+// shard_merge.cc
+
+#include "shard_merge.h"
+#include "columnar_dump.h"
+#include "cursor_id_table.h"
+#include "cxcursor_info.h"
+#include "job_scheduler.h"
+#include "output_sink.h"
+#include "parse_cxcursor_info_options.h"
+#include "symbol_index.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+/* Spreading a project over several machines: -k i/N keeps the translation
+ * units of shard i out of N, and -m merges what the shards wrote back into
+ * one result.
+ *
+ * Every machine has to come up with the same split on its own, so it only
+ * depends on the database, the source files and the -H history, if given
+ * (which then has to be the same file everywhere).  Translation units are
+ * taken from the longest down, as the history or the size of their source
+ * says, each going to the shard with the least work so far (ties to the lower
+ * shard, equal guesses broken by name), which keeps the shards within one
+ * translation unit of each other.  Each shard still dumps
+ * its part in database order.
+ *
+ * -m reads the dumps or indexes named after it and writes the merged result to
+ * -O (or stdout), in the order given.  Symbol indexes are merged USR by USR.
+ * Text dumps can just be concatenated.
+ *
+ * Binary and NDJSON dumps number their cursors (CustomId and the attributes
+ * referring to other cursors) from 1 in every translation unit, so the merge
+ * rebases them translation unit by translation unit, at each change of the
+ * translation_unit column or each translation_unit line (and each new file),
+ * past the largest id of all the translation units before, which keeps ids
+ * unique in the merged dump.  The ids -U gives cursors with a USR are the same
+ * in every shard already (see cursor_id_table.cc) and are kept as they are,
+ * so a USR has one id throughout the merged dump; only the counted ids of
+ * cursors without one are rebased.
+ * */
+
+using namespace std;
+
+void select_shard(const Options &options, vector<CompileJob> &jobs) {
+  vector<double> weights = estimate_job_costs(options.history, jobs);
+  vector<size_t> order(jobs.size());
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (weights[a] != weights[b]) {
+      return weights[a] > weights[b];
+    }
+    return jobs[a].filename < jobs[b].filename;
+  });
+  vector<double> load(options.shard_count, 0);
+  vector<bool> keep(jobs.size(), false);
+  for (size_t i : order) {
+    size_t lightest = 0;
+    for (size_t shard = 1; shard < load.size(); ++shard) {
+      if (load[shard] < load[lightest]) {
+        lightest = shard;
+      }
+    }
+    load[lightest] += weights[i];
+    keep[i] = lightest == options.shard_index;
+  }
+  vector<CompileJob> selected;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (keep[i]) {
+      selected.push_back(std::move(jobs[i]));
+    }
+  }
+  jobs.swap(selected);
+}
+
+enum class MergeFormat { Columns, Symbols, NDJSON, Unknown };
+
+static MergeFormat merge_format(const string &path) {
+  ifstream in(path, ios::binary);
+  char magic[8] = {};
+  in.read(magic, sizeof(magic));
+  if (memcmp(magic, columnar_magic, sizeof(magic)) == 0) {
+    return MergeFormat::Columns;
+  }
+  if (memcmp(magic, symbol_index_magic, sizeof(magic)) == 0) {
+    return MergeFormat::Symbols;
+  }
+  return magic[0] == '{' ? MergeFormat::NDJSON : MergeFormat::Unknown;
+}
+
+static int merge_symbols(const Options &options, OutputSink &out) {
+  return merge_symbol_indexes(options.merge_inputs, out) ? 0 : 1;
+}
+
+static int merge_columns(const Options &options, OutputSink &out) {
+  vector<CursorAttribute> attributes;
+  {
+    ColumnarFile first;
+    if (!first.open(options.merge_inputs[0])) {
+      cerr << "could not read " << options.merge_inputs[0] << ": "
+           << first.error() << endl;
+      return 1;
+    }
+    for (uint32_t c = 2; c < first.column_count(); ++c) {
+      CursorAttribute attribute;
+      if (!find_attribute(first.column(c).name, attribute)) {
+        cerr << "unknown column " << first.column(c).name << endl;
+        return 1;
+      }
+      attributes.push_back(attribute);
+    }
+  }
+  ColumnarDump merged(attributes);
+  for (auto &&path : options.merge_inputs) {
+    ColumnarFile file;
+    if (!file.open(path)) {
+      cerr << "could not read " << path << ": " << file.error() << endl;
+      return 1;
+    }
+    if (!merged.append(file, true)) {
+      cerr << "could not merge " << path
+           << ", shards have to be dumped with the same attributes" << endl;
+      return 1;
+    }
+  }
+  merged.write(out);
+  return 0;
+}
+
+/*
+ * Shifts the value of every counted id attribute on an NDJSON line, and keeps
+ * track of the largest one seen.  USR ids are left alone.
+ */
+static void shift_ids(string &line, uint32_t base, uint32_t &largest) {
+  for (size_t i = 0; i < attribute_count; ++i) {
+    const AttributeEntry &entry = attribute_entry((CursorAttribute)i);
+    if (entry.kind != AttributeValue::Id) {
+      continue;
+    }
+    string key = string("\"") + entry.name + "\":";
+    size_t position = line.find(key);
+    if (position == string::npos) {
+      continue;
+    }
+    size_t start = position + key.size();
+    size_t end = start;
+    while (end < line.size() && isdigit((unsigned char)line[end])) {
+      ++end;
+    }
+    if (end == start) {
+      continue;
+    }
+    uint32_t id = (uint32_t)stoul(line.substr(start, end - start));
+    if (id != 0 && (id & usr_id_bit) == 0) {
+      largest = max(largest, id);
+      line.replace(start, end - start, to_string(id + base));
+    }
+  }
+}
+
+static int merge_ndjson(const Options &options, OutputSink &out) {
+  static const string unit_key = "{\"translation_unit\":";
+  uint32_t base = 0;
+  uint32_t largest = 0;
+  for (auto &&path : options.merge_inputs) {
+    ifstream in(path);
+    if (!in) {
+      cerr << "could not read " << path << endl;
+      return 1;
+    }
+    base += largest;
+    largest = 0;
+    string line;
+    while (getline(in, line)) {
+      if (line.compare(0, unit_key.size(), unit_key) == 0) {
+        base += largest;
+        largest = 0;
+      } else {
+        shift_ids(line, base, largest);
+      }
+      out.buffer() += line;
+      out.buffer() += '\n';
+      out.record_done();
+    }
+  }
+  return 0;
+}
+
+int run_merge(const Options &options, OutputSink &out) {
+  MergeFormat format = merge_format(options.merge_inputs[0]);
+  for (auto &&path : options.merge_inputs) {
+    if (merge_format(path) != format) {
+      cerr << path << " is not in the same format as "
+           << options.merge_inputs[0] << endl;
+      return 1;
+    }
+  }
+  int result = 1;
+  switch (format) {
+  case MergeFormat::Columns:
+    result = merge_columns(options, out);
+    break;
+  case MergeFormat::Symbols:
+    result = merge_symbols(options, out);
+    break;
+  case MergeFormat::NDJSON:
+    result = merge_ndjson(options, out);
+    break;
+  case MergeFormat::Unknown:
+    cerr << "-m merges binary dumps, symbol indexes and NDJSON dumps" << endl;
+    break;
+  }
+  out.flush();
+  return result;
+}
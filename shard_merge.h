@@ -0,0 +1,16 @@
+//shard_merge.h
+#pragma once
+
+#include "project_mode.h"
+
+#include <vector>
+
+struct Options;
+class OutputSink;
+
+/*
+ * See shard_merge.cc for more detailed commentary
+ */
+
+void select_shard(const Options &options, std::vector<CompileJob> &jobs);
+int run_merge(const Options &options, OutputSink &out);
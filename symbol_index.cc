@@ -0,0 +1,648 @@
+// symbol_index.cc
+
+#include "symbol_index.h"
+#include "cxcursor_info.h"
+#include "output_sink.h"
+#include "tu_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The symbol index answers "where is X defined and used" without parsing
+ * anything.  Indexing mode (-I file) walks the translation units once and
+ * records, for every USR, where it is defined, declared and referenced.  The
+ * index file is built to be used straight from mmap:
+ *
+ *   SymbolIndexHeader
+ *   SymbolRecord[symbol_count]      sorted by USR, for binary search
+ *   IndexLocation[location_count]   each symbol's definitions, declarations
+ *                                   and references, in that order
+ *   uint64_t[string_count + 1]      offsets into the string data
+ *   string data                     USRs, names, kinds and file names
+ *
+ * A query (-Q index usr...) maps the file and does one binary search per USR,
+ * so it takes microseconds and never touches libclang.  File names are made
+ * absolute against the directory their translation unit was compiled in, so
+ * the entries of a project index can be told apart and opened from anywhere.
+ *
+ * An index is checked when it is opened, as -m and -n read indexes back too:
+ * every section, string and symbol's run of locations has to lie within the
+ * file.
+ * */
+
+using namespace std;
+
+bool SymbolIndexBuilder::Location::operator<(const Location &other) const {
+  if (file != other.file) {
+    return file < other.file;
+  }
+  if (line != other.line) {
+    return line < other.line;
+  }
+  return col < other.col;
+}
+
+bool SymbolIndexBuilder::Location::operator==(const Location &other) const {
+  return line == other.line && col == other.col && file == other.file;
+}
+
+bool SymbolIndexBuilder::cursor_location(CXCursor cursor,
+                                         Location &location) {
+  CXFile file;
+  clang_getSpellingLocation(clang_getCursorLocation(cursor), &file,
+                            &location.line, &location.col, nullptr);
+  if (file == nullptr) {
+    return false;
+  }
+  auto it = file_names.find(file);
+  if (it == file_names.end()) {
+    string name = resolve_path(directory, string_FileName(file));
+    it = file_names.emplace(file, std::move(name)).first;
+  }
+  location.file = it->second;
+  return true;
+}
+
+/*
+ * What the tables take up is only estimated, from the strings and a guess at
+ * the hash table's overhead per symbol, but that's enough to tell when to
+ * spill them (see --memory-budget in project_mode.cc).
+ */
+static const size_t symbol_overhead = sizeof(SymbolIndexBuilder::Symbol) + 64;
+
+SymbolIndexBuilder::Symbol &SymbolIndexBuilder::symbol(const string &usr) {
+  auto result = symbols.emplace(usr, Symbol());
+  if (result.second) {
+    bytes += symbol_overhead + usr.size();
+  }
+  return result.first->second;
+}
+
+void SymbolIndexBuilder::add_location(vector<Location> &to,
+                                      const Location &location) {
+  to.push_back(location);
+  bytes += sizeof(Location) + location.file.size();
+}
+
+void SymbolIndexBuilder::clear() {
+  symbols.clear();
+  bytes = 0;
+}
+
+void SymbolIndexBuilder::add_cursor(CXCursor cursor) {
+  Location location;
+  if (clang_isDeclaration(cursor.kind)) {
+    string usr = convert_cxstring(clang_getCursorUSR(cursor));
+    if (usr.empty() || usr == "null cxstring" ||
+        !cursor_location(cursor, location)) {
+      return;
+    }
+    Symbol &found = symbol(usr);
+    if (found.name.empty()) {
+      found.name = convert_cxstring(clang_getCursorSpelling(cursor));
+      found.kind = convert_cxstring(clang_getCursorKindSpelling(cursor.kind));
+    }
+    if (clang_isCursorDefinition(cursor)) {
+      add_location(found.definitions, location);
+    } else {
+      add_location(found.declarations, location);
+    }
+    return;
+  }
+  if (!clang_isReference(cursor.kind) && !clang_isExpression(cursor.kind)) {
+    return;
+  }
+  CXCursor referenced = clang_getCursorReferenced(cursor);
+  if (clang_Cursor_isNull(referenced) ||
+      clang_equalCursors(referenced, cursor)) {
+    return;
+  }
+  string usr = convert_cxstring(clang_getCursorUSR(referenced));
+  if (usr.empty() || usr == "null cxstring" ||
+      !cursor_location(cursor, location)) {
+    return;
+  }
+  Symbol &found = symbol(usr);
+  if (found.name.empty()) {
+    found.name = convert_cxstring(clang_getCursorSpelling(referenced));
+    found.kind = convert_cxstring(clang_getCursorKindSpelling(referenced.kind));
+  }
+  add_location(found.references, location);
+}
+
+static CXChildVisitResult index_visitor(CXCursor cursor, CXCursor,
+                                        CXClientData data) {
+  ((SymbolIndexBuilder *)data)->add_cursor(cursor);
+  return CXChildVisit_Recurse;
+}
+
+/*
+ * CXFiles belong to their translation unit, and relative file names to the
+ * directory it was compiled in (empty for ours).
+ */
+void SymbolIndexBuilder::begin_translation_unit(
+    const string &compile_directory) {
+  file_names.clear();
+  directory = compile_directory;
+}
+
+void SymbolIndexBuilder::add_translation_unit(CXTranslationUnit TU,
+                                              const string &compile_directory) {
+  begin_translation_unit(compile_directory);
+  clang_visitChildren(clang_getTranslationUnitCursor(TU), index_visitor, this);
+}
+
+void SymbolIndexBuilder::merge(SymbolIndexBuilder &other) {
+  for (auto &&entry : other.symbols) {
+    Symbol &found = symbol(entry.first);
+    if (found.name.empty()) {
+      found.name = entry.second.name;
+      found.kind = entry.second.kind;
+    }
+    for (auto &&location : entry.second.definitions) {
+      add_location(found.definitions, location);
+    }
+    for (auto &&location : entry.second.declarations) {
+      add_location(found.declarations, location);
+    }
+    for (auto &&location : entry.second.references) {
+      add_location(found.references, location);
+    }
+  }
+  other.clear();
+}
+
+/*
+ * Reads back an index written earlier, as if its translation units had been
+ * added again.
+ */
+void SymbolIndexBuilder::add_index(const SymbolIndex &index) {
+  for (uint64_t i = 0; i < index.size(); ++i) {
+    const SymbolRecord &record = index.symbol(i);
+    Symbol &found = symbol(index.string(record.usr));
+    if (found.name.empty()) {
+      found.name = index.string(record.name);
+      found.kind = index.string(record.kind);
+    }
+    const IndexLocation *location = index.locations(record);
+    vector<Location> *groups[] = {&found.definitions, &found.declarations,
+                                  &found.references};
+    uint32_t counts[] = {record.definition_count, record.declaration_count,
+                         record.reference_count};
+    for (int group = 0; group < 3; ++group) {
+      for (uint32_t n = 0; n < counts[group]; ++n, ++location) {
+        add_location(*groups[group], Location{index.string(location->file),
+                                              location->line, location->col});
+      }
+    }
+  }
+}
+
+/*
+ * Headers get indexed once per translation unit including them, so this is
+ * where the copies are dropped.
+ */
+static void sort_unique(vector<SymbolIndexBuilder::Location> &locations) {
+  sort(locations.begin(), locations.end());
+  locations.erase(unique(locations.begin(), locations.end()),
+                  locations.end());
+}
+
+static size_t align8(size_t offset) { return (offset + 7) & ~size_t(7); }
+
+void SymbolIndexBuilder::write(OutputSink &out) {
+  vector<string> strings;
+  unordered_map<string, uint32_t> string_ids;
+  auto intern = [&](const string &str) {
+    auto it = string_ids.find(str);
+    if (it != string_ids.end()) {
+      return it->second;
+    }
+    uint32_t id = (uint32_t)strings.size();
+    strings.push_back(str);
+    string_ids.emplace(str, id);
+    return id;
+  };
+
+  vector<const string *> usrs;
+  usrs.reserve(symbols.size());
+  for (auto &&entry : symbols) {
+    usrs.push_back(&entry.first);
+  }
+  // the same byte order SymbolIndex::find searches in
+  sort(usrs.begin(), usrs.end(),
+       [](const string *lhs, const string *rhs) { return *lhs < *rhs; });
+
+  vector<SymbolRecord> records;
+  vector<IndexLocation> locations;
+  records.reserve(usrs.size());
+  for (const string *usr : usrs) {
+    Symbol &symbol = symbols[*usr];
+    sort_unique(symbol.definitions);
+    sort_unique(symbol.declarations);
+    sort_unique(symbol.references);
+    SymbolRecord record;
+    record.usr = intern(*usr);
+    record.name = intern(symbol.name);
+    record.kind = intern(symbol.kind);
+    record.definition_count = (uint32_t)symbol.definitions.size();
+    record.declaration_count = (uint32_t)symbol.declarations.size();
+    record.reference_count = (uint32_t)symbol.references.size();
+    record.first_location = locations.size();
+    for (auto *group :
+         {&symbol.definitions, &symbol.declarations, &symbol.references}) {
+      for (auto &&location : *group) {
+        locations.push_back(
+            IndexLocation{intern(location.file), location.line, location.col});
+      }
+    }
+    records.push_back(record);
+  }
+
+  vector<uint64_t> string_offsets(strings.size() + 1, 0);
+  for (size_t i = 0; i < strings.size(); ++i) {
+    string_offsets[i + 1] = string_offsets[i] + strings[i].size();
+  }
+
+  SymbolIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, symbol_index_magic, sizeof(header.magic));
+  header.symbol_count = records.size();
+  header.location_count = locations.size();
+  header.string_count = (uint32_t)strings.size();
+  header.symbols_offset = sizeof(header);
+  header.locations_offset = align8(header.symbols_offset +
+                                   records.size() * sizeof(SymbolRecord));
+  header.string_offsets_offset = align8(
+      header.locations_offset + locations.size() * sizeof(IndexLocation));
+  header.string_data_offset = header.string_offsets_offset +
+                              string_offsets.size() * sizeof(uint64_t);
+
+  size_t start = out.bytes_written();
+  string &result = out.buffer();
+  result.append((const char *)&header, sizeof(header));
+  result.append((const char *)records.data(),
+                records.size() * sizeof(SymbolRecord));
+  result.append(start + header.locations_offset - out.bytes_written(), '\0');
+  result.append((const char *)locations.data(),
+                locations.size() * sizeof(IndexLocation));
+  out.record_done();
+  result.append(start + header.string_offsets_offset - out.bytes_written(),
+                '\0');
+  result.append((const char *)string_offsets.data(),
+                string_offsets.size() * sizeof(uint64_t));
+  for (auto &&str : strings) {
+    result += str;
+    out.record_done();
+  }
+}
+
+SymbolIndex::SymbolIndex()
+    : base(nullptr), length(0), header(nullptr), symbols(nullptr),
+      all_locations(nullptr), string_offsets(nullptr) {}
+
+SymbolIndex::~SymbolIndex() {
+  if (base != nullptr) {
+    munmap((void *)base, length);
+  }
+}
+
+/*
+ * Whether count items of size bytes, starting at offset, lie within a file of
+ * length bytes.
+ */
+static bool section_fits(uint64_t offset, uint64_t count, size_t size,
+                         size_t length) {
+  return offset % 8 == 0 && offset <= length &&
+         count <= (length - offset) / size;
+}
+
+bool SymbolIndex::check() {
+  if (memcmp(header->magic, symbol_index_magic, sizeof(header->magic)) != 0) {
+    problem = "not a symbol index";
+    return false;
+  }
+  if (!section_fits(header->symbols_offset, header->symbol_count,
+                    sizeof(SymbolRecord), length)) {
+    problem = "symbol table lies outside the file";
+    return false;
+  }
+  if (!section_fits(header->locations_offset, header->location_count,
+                    sizeof(IndexLocation), length)) {
+    problem = "location table lies outside the file";
+    return false;
+  }
+  uint64_t offsets_count = (uint64_t)header->string_count + 1;
+  if (!section_fits(header->string_offsets_offset, offsets_count,
+                    sizeof(uint64_t), length) ||
+      header->string_data_offset < header->string_offsets_offset +
+                                       offsets_count * sizeof(uint64_t) ||
+      header->string_data_offset > length) {
+    problem = "string table lies outside the file";
+    return false;
+  }
+  symbols = (const SymbolRecord *)(base + header->symbols_offset);
+  all_locations = (const IndexLocation *)(base + header->locations_offset);
+  string_offsets = (const uint64_t *)(base + header->string_offsets_offset);
+  uint64_t data_size = length - header->string_data_offset;
+  for (uint32_t i = 0; i < header->string_count; ++i) {
+    if (string_offsets[i] > string_offsets[i + 1] ||
+        string_offsets[i + 1] > data_size) {
+      problem = "string " + to_string(i) + " lies outside the file";
+      return false;
+    }
+  }
+  for (uint64_t i = 0; i < header->symbol_count; ++i) {
+    const SymbolRecord &record = symbols[i];
+    uint64_t count = (uint64_t)record.definition_count +
+                     record.declaration_count + record.reference_count;
+    if (record.usr >= header->string_count ||
+        record.name >= header->string_count ||
+        record.kind >= header->string_count ||
+        record.first_location > header->location_count ||
+        count > header->location_count - record.first_location) {
+      problem = "symbol " + to_string(i) + " lies outside the file";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SymbolIndex::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    problem = "could not open it";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (size_t)info.st_size < sizeof(SymbolIndexHeader)) {
+    problem = "too short for a symbol index";
+    close(fd);
+    return false;
+  }
+  void *mapping =
+      mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    problem = "could not map it";
+    return false;
+  }
+  base = (const char *)mapping;
+  length = (size_t)info.st_size;
+  header = (const SymbolIndexHeader *)base;
+  if (!check()) {
+    munmap(mapping, length);
+    base = nullptr;
+    return false;
+  }
+  return true;
+}
+
+std::string SymbolIndex::string(uint32_t index) const {
+  if (index >= header->string_count) {
+    return "";
+  }
+  return std::string(base + header->string_data_offset + string_offsets[index],
+                     string_offsets[index + 1] - string_offsets[index]);
+}
+
+int SymbolIndex::compare(uint32_t index, const std::string &str) const {
+  const char *data = base + header->string_data_offset + string_offsets[index];
+  size_t size = string_offsets[index + 1] - string_offsets[index];
+  int result = memcmp(data, str.data(), min(size, str.size()));
+  if (result != 0) {
+    return result;
+  }
+  return size < str.size() ? -1 : size > str.size() ? 1 : 0;
+}
+
+const SymbolRecord *SymbolIndex::find(const std::string &usr) const {
+  uint64_t low = 0;
+  uint64_t high = header->symbol_count;
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    int result = compare(symbols[middle].usr, usr);
+    if (result == 0) {
+      return &symbols[middle];
+    } else if (result < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return nullptr;
+}
+
+std::string SymbolIndex::string_location(const IndexLocation &location) const {
+  return string(location.file) + ":" + to_string(location.line) + ":" +
+         to_string(location.col);
+}
+
+void dump_symbol(const SymbolIndex &index, const SymbolRecord &record,
+                 std::string &result) {
+  result += "usr: " + index.string(record.usr) + "\n";
+  result += "name: " + index.string(record.name) + "\n";
+  result += "kind: " + index.string(record.kind) + "\n";
+  const IndexLocation *location = index.locations(record);
+  const char *roles[] = {"definition: ", "declaration: ", "reference: "};
+  uint32_t counts[] = {record.definition_count, record.declaration_count,
+                       record.reference_count};
+  for (int role = 0; role < 3; ++role) {
+    for (uint32_t i = 0; i < counts[role]; ++i, ++location) {
+      result += roles[role] + index.string_location(*location) + "\n";
+    }
+  }
+}
+
+/*
+ * Merging indexes is streamed.  Every input is already sorted by USR, so a heap
+ * over each input's next symbol yields the output in order, one USR at a time.
+ * Records, locations and strings go to temporary files until the header's
+ * counts are known; only file names and kinds, which repeat endlessly, are
+ * interned in memory.  That keeps --memory-budget runs, and -m, from ever
+ * holding a whole index.
+ */
+namespace {
+struct MergeInput {
+  const SymbolIndex *index;
+  uint64_t next;
+  std::string usr;
+};
+} // namespace
+
+static bool copy_temporary(FILE *file, OutputSink &out) {
+  rewind(file);
+  char chunk[1 << 16];
+  size_t size;
+  while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    out.buffer().append(chunk, size);
+    out.record_done();
+  }
+  return !ferror(file);
+}
+
+bool merge_symbol_indexes(const vector<std::string> &paths, OutputSink &out) {
+  vector<unique_ptr<SymbolIndex>> indexes;
+  for (auto &&path : paths) {
+    indexes.emplace_back(new SymbolIndex);
+    if (!indexes.back()->open(path)) {
+      cerr << "could not read the symbol index " << path << ": "
+           << indexes.back()->error() << endl;
+      return false;
+    }
+  }
+  unique_ptr<FILE, int (*)(FILE *)> records(tmpfile(), fclose),
+      locations(tmpfile(), fclose), string_offsets(tmpfile(), fclose),
+      string_data(tmpfile(), fclose);
+  if (!records || !locations || !string_offsets || !string_data) {
+    cerr << "could not create temporary files to merge symbol indexes"
+         << endl;
+    return false;
+  }
+
+  uint32_t string_count = 0;
+  uint64_t string_size = 0;
+  auto add_string = [&](const std::string &str) {
+    fwrite(&string_size, sizeof(string_size), 1, string_offsets.get());
+    fwrite(str.data(), 1, str.size(), string_data.get());
+    string_size += str.size();
+    return string_count++;
+  };
+  unordered_map<std::string, uint32_t> shared_strings;
+  auto intern = [&](const std::string &str) {
+    auto it = shared_strings.find(str);
+    if (it == shared_strings.end()) {
+      it = shared_strings.emplace(str, add_string(str)).first;
+    }
+    return it->second;
+  };
+
+  auto later = [](const MergeInput &lhs, const MergeInput &rhs) {
+    return lhs.usr > rhs.usr;
+  };
+  priority_queue<MergeInput, vector<MergeInput>, decltype(later)> heap(later);
+  for (auto &&index : indexes) {
+    if (index->size() > 0) {
+      heap.push(
+          MergeInput{index.get(), 0, index->string(index->symbol(0).usr)});
+    }
+  }
+
+  uint64_t symbol_count = 0;
+  uint64_t location_count = 0;
+  while (!heap.empty()) {
+    std::string usr = heap.top().usr;
+    SymbolIndexBuilder::Symbol symbol;
+    while (!heap.empty() && heap.top().usr == usr) {
+      MergeInput input = heap.top();
+      heap.pop();
+      const SymbolIndex &index = *input.index;
+      const SymbolRecord &record = index.symbol(input.next);
+      if (symbol.name.empty()) {
+        symbol.name = index.string(record.name);
+        symbol.kind = index.string(record.kind);
+      }
+      const IndexLocation *location = index.locations(record);
+      vector<SymbolIndexBuilder::Location> *groups[] = {
+          &symbol.definitions, &symbol.declarations, &symbol.references};
+      uint32_t counts[] = {record.definition_count, record.declaration_count,
+                           record.reference_count};
+      for (int group = 0; group < 3; ++group) {
+        for (uint32_t i = 0; i < counts[group]; ++i, ++location) {
+          groups[group]->push_back(SymbolIndexBuilder::Location{
+              index.string(location->file), location->line, location->col});
+        }
+      }
+      if (++input.next < index.size()) {
+        input.usr = index.string(index.symbol(input.next).usr);
+        heap.push(input);
+      }
+    }
+
+    SymbolRecord record;
+    record.usr = add_string(usr);
+    record.name = add_string(symbol.name);
+    record.kind = intern(symbol.kind);
+    record.first_location = location_count;
+    uint32_t *counts[] = {&record.definition_count, &record.declaration_count,
+                          &record.reference_count};
+    int group = 0;
+    for (auto *locations_in_group :
+         {&symbol.definitions, &symbol.declarations, &symbol.references}) {
+      sort_unique(*locations_in_group);
+      *counts[group++] = (uint32_t)locations_in_group->size();
+      for (auto &&location : *locations_in_group) {
+        IndexLocation cell{intern(location.file), location.line, location.col};
+        fwrite(&cell, sizeof(cell), 1, locations.get());
+        ++location_count;
+      }
+    }
+    fwrite(&record, sizeof(record), 1, records.get());
+    ++symbol_count;
+  }
+  fwrite(&string_size, sizeof(string_size), 1, string_offsets.get());
+
+  SymbolIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, symbol_index_magic, sizeof(header.magic));
+  header.symbol_count = symbol_count;
+  header.location_count = location_count;
+  header.string_count = string_count;
+  header.symbols_offset = sizeof(header);
+  header.locations_offset =
+      align8(header.symbols_offset + symbol_count * sizeof(SymbolRecord));
+  header.string_offsets_offset =
+      align8(header.locations_offset + location_count * sizeof(IndexLocation));
+  header.string_data_offset =
+      header.string_offsets_offset + (string_count + 1) * sizeof(uint64_t);
+
+  size_t start = out.bytes_written();
+  out.buffer().append((const char *)&header, sizeof(header));
+  bool ok = copy_temporary(records.get(), out);
+  out.buffer().append(start + header.locations_offset - out.bytes_written(),
+                      '\0');
+  ok = copy_temporary(locations.get(), out) && ok;
+  out.buffer().append(
+      start + header.string_offsets_offset - out.bytes_written(), '\0');
+  ok = copy_temporary(string_offsets.get(), out) && ok;
+  ok = copy_temporary(string_data.get(), out) && ok;
+  if (!ok) {
+    cerr << "could not read back the merged symbol index" << endl;
+  }
+  return ok;
+}
+
+int run_symbol_query(const std::string &index_path,
+                     const vector<std::string> &usrs, OutputSink &out) {
+  SymbolIndex index;
+  if (!index.open(index_path)) {
+    out.buffer() += "could not open symbol index " + index_path + ": " +
+                    index.error() + "\n";
+    out.flush();
+    return 1;
+  }
+  int result = 0;
+  for (auto &&usr : usrs) {
+    const SymbolRecord *record = index.find(usr);
+    if (record == nullptr) {
+      out.buffer() += "usr: " + usr + "\nnot found\n";
+      result = 1;
+    } else {
+      dump_symbol(index, *record, out.buffer());
+    }
+    out.buffer() += "\n";
+    out.record_done();
+  }
+  out.flush();
+  return result;
+}
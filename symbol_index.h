@@ -0,0 +1,130 @@
+//symbol_index.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class OutputSink;
+class SymbolIndex;
+
+/*
+ * See symbol_index.cc for more detailed commentary
+ */
+
+struct SymbolIndexHeader {
+  char magic[8];
+  std::uint64_t symbol_count;
+  std::uint64_t location_count;
+  std::uint32_t string_count;
+  std::uint32_t reserved;
+  std::uint64_t symbols_offset;
+  std::uint64_t locations_offset;
+  std::uint64_t string_offsets_offset;
+  std::uint64_t string_data_offset;
+};
+
+struct SymbolRecord {
+  std::uint32_t usr;
+  std::uint32_t name;
+  std::uint32_t kind;
+  std::uint32_t definition_count;
+  std::uint32_t declaration_count;
+  std::uint32_t reference_count;
+  std::uint64_t first_location;
+};
+
+struct IndexLocation {
+  std::uint32_t file;
+  std::uint32_t line;
+  std::uint32_t col;
+};
+
+static const char symbol_index_magic[8] = {'C', 'X', 'S', 'Y', 'M', 'S', '1', 0};
+
+/*
+ * Collects symbols from translation units in memory, and writes the index.
+ */
+class SymbolIndexBuilder {
+public:
+  SymbolIndexBuilder() : bytes(0) {}
+  void begin_translation_unit(const std::string &compile_directory);
+  void add_translation_unit(CXTranslationUnit TU,
+                            const std::string &compile_directory);
+  void add_cursor(CXCursor cursor);
+  void merge(SymbolIndexBuilder &other);
+  void add_index(const SymbolIndex &index);
+  std::size_t size() const { return symbols.size(); }
+  std::size_t memory() const { return bytes; }
+  void write(OutputSink &out);
+  void clear();
+
+  struct Location {
+    std::string file;
+    unsigned line;
+    unsigned col;
+    bool operator<(const Location &other) const;
+    bool operator==(const Location &other) const;
+  };
+  struct Symbol {
+    std::string name;
+    std::string kind;
+    std::vector<Location> definitions;
+    std::vector<Location> declarations;
+    std::vector<Location> references;
+  };
+
+private:
+  std::unordered_map<std::string, Symbol> symbols;
+  std::unordered_map<CXFile, std::string> file_names;
+  std::string directory;
+  std::size_t bytes;
+
+  bool cursor_location(CXCursor cursor, Location &location);
+  Symbol &symbol(const std::string &usr);
+  void add_location(std::vector<Location> &to, const Location &location);
+};
+
+/*
+ * A read only, memory mapped symbol index.
+ */
+class SymbolIndex {
+public:
+  SymbolIndex();
+  ~SymbolIndex();
+  SymbolIndex(const SymbolIndex &) = delete;
+  SymbolIndex &operator=(const SymbolIndex &) = delete;
+
+  bool open(const std::string &path);
+  std::uint64_t size() const { return header->symbol_count; }
+  const SymbolRecord *find(const std::string &usr) const;
+  const SymbolRecord &symbol(std::uint64_t i) const { return symbols[i]; }
+  const IndexLocation *locations(const SymbolRecord &record) const {
+    return all_locations + record.first_location;
+  }
+  std::string string(std::uint32_t index) const;
+  std::string string_location(const IndexLocation &location) const;
+  const std::string &error() const { return problem; }
+
+private:
+  std::string problem;
+  const char *base;
+  std::size_t length;
+  const SymbolIndexHeader *header;
+  const SymbolRecord *symbols;
+  const IndexLocation *all_locations;
+  const std::uint64_t *string_offsets;
+
+  bool check();
+  int compare(std::uint32_t index, const std::string &str) const;
+};
+
+void dump_symbol(const SymbolIndex &index, const SymbolRecord &record,
+                 std::string &result);
+bool merge_symbol_indexes(const std::vector<std::string> &paths,
+                          OutputSink &out);
+int run_symbol_query(const std::string &index_path,
+                     const std::vector<std::string> &usrs, OutputSink &out);
@@ -0,0 +1,346 @@
+// tu_cache.cc
+
+#include "tu_cache.h"
+#include "cxcursor_info.h"
+#include "parse_cxcursor_info_options.h"
+#include "profiler.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* An on-disk cache of parsed translation units.  The frontend is by far the
+ * most expensive part of a run, so a translation unit that hasn't changed is
+ * saved with clang_saveTranslationUnit and loaded again with
+ * clang_createTranslationUnit, which just deserializes the AST.
+ *
+ * An entry is found in two steps.  The primary key hashes the clang version,
+ * the source path and contents, the compile flags and the parse options (a
+ * -P decls AST has no function bodies); it names a .deps file
+ * listing every header the source included last time, along with the hash of
+ * its contents.  The headers are re-hashed, and the primary key combined with
+ * those hashes names the .ast file.  So a changed header just leads to a
+ * different .ast name, and the old one is left alone (clear the directory
+ * every so often if that bothers you).
+ *
+ * clang names included files the way the include path led to them, so with
+ * -Iinc a header may be just inc/common.h, relative to the directory the
+ * translation unit was compiled in rather than to ours.  They are made
+ * absolute against that directory before they are hashed or written to a
+ * .deps file.
+ *
+ * A loaded AST spells its translation unit with the absolute path of the
+ * source, where a parse spells it the way the command line named it.  So the
+ * parse's spelling is kept in a .name file next to the .ast, and the
+ * translation unit cursor's CursorSpelling and CursorDisplayName give it back
+ * (see cached_spelling), which keeps a cache hit from changing the dump.
+ * Translation units from parse_translation_unit are disposed of with
+ * dispose_translation_unit, which forgets their spelling.
+ * */
+
+using namespace std;
+
+/// FNV-1a, nothing fancy but plenty for telling file versions apart
+ContentHash hash_bytes(const char *data, size_t size, ContentHash seed) {
+  ContentHash hash = seed;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+ContentHash hash_string(const string &str, ContentHash seed) {
+  // hash the terminator too, so {"ab", "c"} and {"a", "bc"} differ
+  return hash_bytes(str.c_str(), str.size() + 1, seed);
+}
+
+bool hash_file(const string &path, ContentHash &hash) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+  hash = hash_string(path);
+  char buffer[1 << 16];
+  while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+    hash = hash_bytes(buffer, (size_t)file.gcount(), hash);
+  }
+  return true;
+}
+
+string string_hash(ContentHash hash) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+  return buffer;
+}
+
+/*
+ * An empty directory stands for our own.
+ */
+string resolve_path(const string &directory, const string &path) {
+  if (path.empty() || path[0] == '/') {
+    return path;
+  }
+  if (!directory.empty()) {
+    return directory + "/" + path;
+  }
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    return path;
+  }
+  return string(cwd) + "/" + path;
+}
+
+namespace {
+struct Inclusions {
+  const string &directory;
+  vector<string> files;
+};
+} // namespace
+
+static void collect_inclusion(CXFile included_file, CXSourceLocation *,
+                              unsigned include_len, CXClientData data) {
+  // depth 0 is the main file itself
+  if (include_len == 0) {
+    return;
+  }
+  Inclusions *inclusions = (Inclusions *)data;
+  inclusions->files.push_back(resolve_path(inclusions->directory,
+                                           string_FileName(included_file)));
+}
+
+vector<string> included_files(CXTranslationUnit TU, const string &directory) {
+  Inclusions inclusions{directory, {}};
+  clang_getInclusions(TU, collect_inclusion, &inclusions);
+  return std::move(inclusions.files);
+}
+
+static bool primary_key(const string &source,
+                        const vector<const char *> &args, unsigned flags,
+                        ContentHash &key) {
+  if (!hash_file(source, key)) {
+    return false;
+  }
+  key = hash_string(string_ClangVersion(), key);
+  key = hash_bytes((const char *)&flags, sizeof(flags), key);
+  for (auto &&arg : args) {
+    key = hash_string(arg, key);
+  }
+  return true;
+}
+
+/*
+ * Returns false if a header has gone missing, in which case the entry can't
+ * be valid anymore, and names it in missing.
+ */
+static bool full_key(ContentHash primary, const vector<string> &headers,
+                     ContentHash &key, string *missing = nullptr) {
+  key = primary;
+  for (auto &&header : headers) {
+    ContentHash header_hash;
+    if (!hash_file(header, header_hash)) {
+      if (missing != nullptr) {
+        *missing = header;
+      }
+      return false;
+    }
+    key = hash_bytes((const char *)&header_hash, sizeof(header_hash), key);
+  }
+  return true;
+}
+
+static string cache_path(const string &cache_directory, ContentHash key,
+                         const string &extension) {
+  return cache_directory + "/" + string_hash(key) + extension;
+}
+
+/*
+ * Write to a private temporary and rename it into place, so a concurrent
+ * reader never sees half a file.
+ */
+static string temporary_path(const string &path) {
+  return path + ".tmp" + to_string(getpid()) + "." +
+         to_string(hash<thread::id>()(this_thread::get_id()));
+}
+
+static mutex spellings_mutex;
+static unordered_map<CXTranslationUnit, string> spellings;
+
+bool cached_spelling(CXTranslationUnit TU, string &spelling) {
+  lock_guard<mutex> guard(spellings_mutex);
+  auto it = spellings.find(TU);
+  if (it == spellings.end()) {
+    return false;
+  }
+  spelling = it->second;
+  return true;
+}
+
+void dispose_translation_unit(CXTranslationUnit TU) {
+  {
+    lock_guard<mutex> guard(spellings_mutex);
+    spellings.erase(TU);
+  }
+  clang_disposeTranslationUnit(TU);
+}
+
+CXTranslationUnit cache_load(CXIndex index, const string &cache_directory,
+                             const string &source,
+                             const vector<const char *> &args,
+                             unsigned flags) {
+  ContentHash primary;
+  if (!primary_key(source, args, flags, primary)) {
+    return nullptr;
+  }
+  ifstream deps(cache_path(cache_directory, primary, ".deps"));
+  if (!deps) {
+    return nullptr;
+  }
+  vector<string> headers;
+  string header;
+  while (getline(deps, header)) {
+    if (!header.empty()) {
+      headers.push_back(header);
+    }
+  }
+  ContentHash key;
+  if (!full_key(primary, headers, key)) {
+    return nullptr;
+  }
+  string ast = cache_path(cache_directory, key, ".ast");
+  ifstream name(cache_path(cache_directory, key, ".name"));
+  string spelling;
+  if (access(ast.c_str(), R_OK) != 0 || !getline(name, spelling)) {
+    return nullptr;
+  }
+  CXTranslationUnit TU = clang_createTranslationUnit(index, ast.c_str());
+  if (TU != nullptr) {
+    lock_guard<mutex> guard(spellings_mutex);
+    spellings[TU] = spelling;
+  }
+  return TU;
+}
+
+/*
+ * Says why on stderr when the translation unit can't be cached.
+ */
+bool cache_store(CXTranslationUnit TU, const string &cache_directory,
+                 const string &source, const string &directory,
+                 const vector<const char *> &args, unsigned flags) {
+  ContentHash primary;
+  if (!primary_key(source, args, flags, primary)) {
+    cerr << "not caching " << source << ": could not read it" << endl;
+    return false;
+  }
+  vector<string> headers = included_files(TU, directory);
+  ContentHash key;
+  string missing;
+  if (!full_key(primary, headers, key, &missing)) {
+    cerr << "not caching " << source << ": could not read " << missing
+         << endl;
+    return false;
+  }
+  mkdir(cache_directory.c_str(), 0755);
+
+  // written before the .ast, so a loadable .ast always has one
+  string name = cache_path(cache_directory, key, ".name");
+  string name_tmp = temporary_path(name);
+  {
+    ofstream out(name_tmp);
+    out << convert_cxstring(clang_getTranslationUnitSpelling(TU)) << '\n';
+    if (!out) {
+      cerr << "not caching " << source << ": could not write " << name_tmp
+           << endl;
+      remove(name_tmp.c_str());
+      return false;
+    }
+  }
+  rename(name_tmp.c_str(), name.c_str());
+
+  string ast = cache_path(cache_directory, key, ".ast");
+  string ast_tmp = temporary_path(ast);
+  if (clang_saveTranslationUnit(TU, ast_tmp.c_str(),
+                                clang_defaultSaveOptions(TU)) !=
+      CXSaveError_None) {
+    cerr << "not caching " << source << ": could not save it in "
+         << cache_directory << endl;
+    remove(ast_tmp.c_str());
+    return false;
+  }
+  rename(ast_tmp.c_str(), ast.c_str());
+
+  string deps = cache_path(cache_directory, primary, ".deps");
+  string deps_tmp = temporary_path(deps);
+  {
+    ofstream out(deps_tmp);
+    for (auto &&header : headers) {
+      out << header << '\n';
+    }
+    if (!out) {
+      cerr << "not caching " << source << ": could not write " << deps_tmp
+           << endl;
+      remove(deps_tmp.c_str());
+      return false;
+    }
+  }
+  rename(deps_tmp.c_str(), deps.c_str());
+  return true;
+}
+
+/*
+ * full parses the way clang_createTranslationUnitFromSourceFile always did,
+ * with the preprocessing record so macros show up as cursors.  decls is for
+ * dumping the API of headers: function bodies are skipped, which is most of
+ * the work in a typical .cc, and a missing header or an error doesn't stop the
+ * parse, since an approximate AST is still worth dumping.
+ */
+unsigned parse_flags(const Options &options) {
+  switch (options.parse_profile) {
+  case ParseProfile::Decls:
+    return CXTranslationUnit_SkipFunctionBodies | CXTranslationUnit_Incomplete |
+           CXTranslationUnit_KeepGoing;
+  case ParseProfile::Full:
+    break;
+  }
+  return CXTranslationUnit_DetailedPreprocessingRecord;
+}
+
+/*
+ * The source is expected among the arguments, as it is in a compilation
+ * database; it is named separately for the cache key.  directory is the one
+ * it is compiled in, which relative includes are found from (empty for ours).
+ */
+CXTranslationUnit parse_translation_unit(CXIndex index, const string &source,
+                                         const string &directory,
+                                         const vector<const char *> &args,
+                                         const Options &options) {
+  PhaseTimer timer(ProfilePhase::Parse);
+  unsigned flags = parse_flags(options);
+  CXTranslationUnit TU = nullptr;
+  if (!options.cache.empty()) {
+    TU = cache_load(index, options.cache, source, args, flags);
+    if (TU != nullptr) {
+      return TU;
+    }
+  }
+  CXErrorCode error = clang_parseTranslationUnit2(
+      index, nullptr, args.data(), (int)args.size(), nullptr, 0, flags, &TU);
+  if (error != CXError_Success) {
+    cerr << "parsing " << source << " failed with libclang error " << error
+         << endl;
+    return nullptr;
+  }
+  if (!options.cache.empty()) {
+    cache_store(TU, options.cache, source, directory, args, flags);
+  }
+  return TU;
+}
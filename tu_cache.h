@@ -0,0 +1,43 @@
+//tu_cache.h
+#pragma once
+
+#include "clang-c/Index.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Options;
+
+/*
+ * See tu_cache.cc for more detailed commentary
+ */
+
+using ContentHash = std::uint64_t;
+
+ContentHash hash_bytes(const char *data, std::size_t size,
+                       ContentHash seed = 14695981039346656037ULL);
+ContentHash hash_string(const std::string &str,
+                        ContentHash seed = 14695981039346656037ULL);
+bool hash_file(const std::string &path, ContentHash &hash);
+std::string string_hash(ContentHash hash);
+std::string resolve_path(const std::string &directory,
+                         const std::string &path);
+std::vector<std::string> included_files(CXTranslationUnit TU,
+                                        const std::string &directory);
+
+CXTranslationUnit cache_load(CXIndex index, const std::string &cache_directory,
+                             const std::string &source,
+                             const std::vector<const char *> &args,
+                             unsigned flags);
+bool cache_store(CXTranslationUnit TU, const std::string &cache_directory,
+                 const std::string &source, const std::string &directory,
+                 const std::vector<const char *> &args, unsigned flags);
+unsigned parse_flags(const Options &options);
+CXTranslationUnit parse_translation_unit(CXIndex index,
+                                         const std::string &source,
+                                         const std::string &directory,
+                                         const std::vector<const char *> &args,
+                                         const Options &options);
+bool cached_spelling(CXTranslationUnit TU, std::string &spelling);
+void dispose_translation_unit(CXTranslationUnit TU);